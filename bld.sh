@@ -30,10 +30,13 @@ if [ $? -ne 0 ]; then echo error in um_perf_pub.c; exit 1; fi
 gcc -Wall -g -I $LBM/include -I $LBM/include/lbm -o um_perf_sub cprt.c um_perf_sub.c $LIBS
 if [ $? -ne 0 ]; then echo error in um_perf_sub.c; exit 1; fi
 
-gcc -Wall -g -o sock_perf_pub cprt.c sock_perf_pub.c $LIBS
+gcc -Wall -g -o sock_perf_pub cprt.c sock_uring.c sock_perf_pub.c $LIBS
 if [ $? -ne 0 ]; then echo error in sock_perf_pub.c; exit 1; fi
 
 gcc -Wall -g -o sock_perf_pub2 cprt.c sock_perf_pub2.c $LIBS
 if [ $? -ne 0 ]; then echo error in sock_perf_pub2.c; exit 1; fi
 
+gcc -Wall -g -o sock_perf_sub cprt.c sock_uring.c sock_perf_sub.c $LIBS
+if [ $? -ne 0 ]; then echo error in sock_perf_sub.c; exit 1; fi
+
 echo "Success"
@@ -26,6 +26,9 @@
 #include <time.h>
 #include <errno.h>
 #include <stdarg.h>
+#if ! defined(_WIN32)
+  #include <sys/resource.h>
+#endif
 
 #if defined(_WIN32)
 LARGE_INTEGER cprt_frequency;
@@ -372,6 +375,19 @@ int cprt_try_affinity(uint64_t in_mask)
 }  /* cprt_try_affinity */
 
 
+/* Lower the calling thread's scheduling priority, for background threads
+ * (e.g. statistics) that shouldn't compete with the time-critical ones. */
+void cprt_set_priority_low()
+{
+#if defined(_WIN32)
+  SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_LOWEST);
+#else
+  /* On Linux, "who" 0 is the calling thread, not the whole process. */
+  (void)setpriority(PRIO_PROCESS, 0, 19);
+#endif
+}  /* cprt_set_priority_low */
+
+
 #define CPRT_MAX_EVENTS 1024
 int cprt_num_events = 0;
 int cprt_events[CPRT_MAX_EVENTS];
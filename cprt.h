@@ -544,6 +544,7 @@ extern "C" {
 char *cprt_strerror(int errnum, char *buffer, size_t buf_sz);
 void cprt_set_affinity(uint64_t in_mask);
 int cprt_try_affinity(uint64_t in_mask);
+void cprt_set_priority_low();
 void cprt_inittime();
 void cprt_sleep_ns(uint64_t duration_ns);
 void cprt_localtime_r(time_t *timep, struct tm *result);
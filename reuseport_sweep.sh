@@ -0,0 +1,49 @@
+#!/bin/sh
+# reuseport_sweep.sh - measure how sock_perf_sub scales with receive threads.
+#
+# For each thread count N in THREADS, runs sock_perf_sub with N SO_REUSEPORT
+# receive threads ("-N N,SUB_CPU,cpu") on a unicast loopback address, and N
+# sock_perf_pub instances (one flow each), each sending RATE msgs/sec.
+# On loopback, a datagram is processed by the kernel on the sending CPU, so
+# steering by CPU with the publishers pinned to N consecutive CPUs gives
+# each receive thread exactly one publisher. Prints the merged receive
+# rate, CPU time per message, and lost messages for each N. The full
+# output of each run is kept in reuseport_sweep_<N>_sub.log.
+#
+# Environment variables (defaults in brackets):
+#   THREADS - receive thread counts to run [1 2 4 8]
+#   RATE - message rate per publisher [200000]
+#   NUM_MSGS - messages per publisher [1000000]
+#   MSG_LEN - message length [100]
+#   ENGINE - sock_perf_sub "-e" receive engine [recvmmsg]
+#   ADDR - unicast address [127.0.0.1]
+#   SUB_CPU - first receive thread CPU [8]
+#   PUB_CPU - first publisher CPU [0]
+
+THREADS=${THREADS:-"1 2 4 8"}
+RATE=${RATE:-200000}
+NUM_MSGS=${NUM_MSGS:-1000000}
+MSG_LEN=${MSG_LEN:-100}
+ENGINE=${ENGINE:-recvmmsg}
+ADDR=${ADDR:-127.0.0.1}
+SUB_CPU=${SUB_CPU:-8}
+PUB_CPU=${PUB_CPU:-0}
+
+for N in $THREADS; do :
+  ./sock_perf_sub -g $ADDR -e $ENGINE -N $N,$SUB_CPU,cpu -t 2000 \
+    >reuseport_sweep_${N}_sub.log 2>&1 &
+  SUB_PID=$!
+  sleep 1
+
+  I=0
+  while [ $I -lt $N ]; do :
+    ./sock_perf_pub -g $ADDR -i $ADDR -c -a `expr $PUB_CPU + $I` -m $MSG_LEN \
+      -n $NUM_MSGS -r $RATE -w 10,1000 >/dev/null 2>&1 &
+    I=`expr $I + 1`
+  done
+
+  wait $SUB_PID
+  wait
+  echo "threads=$N, `grep '^exit_reason=' reuseport_sweep_${N}_sub.log | sed 's/.*\(lost_msgs=[^,]*\).*\(cpu_ns_per_msg=[^,]*\).*\(result_rate=[^,]*\).*/\3, \2, \1/'`, "
+done
+exit 0
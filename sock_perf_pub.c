@@ -30,6 +30,7 @@
  * However, due to the differences between the Linux and Windows socket
  * APIs, no attempt is made to make sock_perf_pub portible to Windows.
  */
+#define _GNU_SOURCE  /* For sendmmsg(). */
 #include "cprt.h"
 
 #include <stdio.h>
@@ -37,42 +38,103 @@
 #if ! defined(_WIN32)
   #include <sys/types.h>
   #include <sys/socket.h>
+  #include <sys/resource.h>
   #include <netinet/in.h>
+  #include <netinet/udp.h>
   #include <arpa/inet.h>
+  #include <linux/errqueue.h>
+  #include <linux/net_tstamp.h>
   #include <stdlib.h>
   #include <unistd.h>
 #endif
 
 #include "um_perf.h"
+#include "sock_uring.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103  /* Linux 4.18+; missing from older libc headers. */
+#endif
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60  /* Linux 4.14+. */
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
 
 
 /* Command-line options and their defaults. String defaults are set
  * in "get_my_opts()".
  */
 static int o_affinity_cpu = -1;
+static int o_connect = 0;  /* -c */
+static char *o_engine = NULL;  /* -e */
 static char *o_group = NULL;
 static char *o_histogram = NULL;  /* -H */
 static char *o_interface = NULL;
+static int o_kernel_ts = 0;  /* -K */
 static int o_msg_len = 0;
 static int o_num_msgs = 0;
 static int o_rate = 0;
 static int o_sleep_usec = 0;
+static int o_timestamp = 0;  /* -T */
 static char *o_warmup = NULL;
+static int o_zerocopy_bufs = 0;  /* -z */
 
 /* Parameters parsed out from command-line options. */
 int hist_num_buckets;
 int hist_ns_per_bucket;
 struct in_addr iface_in;
 struct in_addr group_in;
+#define ENGINE_SENDMSG 0   /* One sendmsg() per message. */
+#define ENGINE_SENDMMSG 1  /* All due messages (up to batch) per sendmmsg(). */
+#define ENGINE_GSO 2       /* All due messages (up to batch) per UDP_SEGMENT send. */
+#define ENGINE_URING 3     /* All due messages (up to batch) as io_uring SQEs. */
+#define GSO_MAX_SEGS 64    /* Kernel's UDP_MAX_SEGMENTS (older kernels). */
+#define GSO_MAX_BYTES 65000  /* Must fit in one IP datagram. */
+int send_engine;
+int send_batch = 1;
+int uring_sqpoll;
 int warmup_loops;
 int warmup_rate;
 
 /* Globals. The code depends on the loader initializing them to all zeros. */
 perf_msg_t *perf_msg;
 int global_max_tight_sends;
-
-
-char usage_str[] = "Usage: sock_perf_pub [-h] [-a affinity_cpu] [-g group] [-H hist_num_buckets,hist_ns_per_bucket] [-i interface] [-m msg_len] [-n num_msgs] [-r rate] [-s sleep_usec] [-w warmup_loops,warmup_rate]";
+/* Also used as the message number, so it keeps counting across the warmup
+ * and measurement send loops (for sock_perf_sub's gap detection). */
+uint64_t total_sends;
+uint64_t num_syscalls;  /* Send calls. */
+/* Message buffers, one per message of a batch. perf_msg is the first. */
+#define CACHE_LINE_SIZE 64
+char *msg_bufs;
+size_t msg_buf_size;  /* Buffer stride. */
+struct sockaddr_in dest_sin;
+struct mmsghdr *mmsgs;
+struct iovec *msg_iovs;
+/* The GSO engine sends the buffers as one super-buffer. */
+struct msghdr gso_hdr;
+struct iovec gso_iov;
+sock_uring_t uring;
+/* MSG_ZEROCOPY (-z). The kernel numbers the zerocopy sends on a socket
+ * 0, 1, 2, ... and reports completed ranges of those IDs on the socket's
+ * error queue. Send ID "id" uses pool buffer "id % o_zerocopy_bufs", which
+ * must not be overwritten until its completion is reaped. */
+char *zc_pool;
+uint8_t *zc_busy;  /* Per pool buffer. */
+uint32_t zc_next_id;
+int zc_send_flags;  /* MSG_ZEROCOPY, or 0 if not zerocopy. */
+uint64_t zc_completions;
+uint64_t zc_copied;  /* Completions where the kernel copied after all. */
+uint64_t zc_waits;  /* Sends that waited for a pool buffer. */
+/* Kernel TX timestamps (-K). With SOF_TIMESTAMPING_OPT_ID, the kernel
+ * numbers the datagrams sent on the socket 0, 1, 2, ..., which matches
+ * msg_num since timestamping is enabled before the first send. */
+uint64_t kts_last_msg_num = (uint64_t)-1;
+struct timespec kts_last_tx_ts;
+uint64_t kts_num_tx_ts;
+
+
+char usage_str[] = "Usage: sock_perf_pub [-h] [-a affinity_cpu] [-c] [-e engine[,batch]] [-g group] [-H hist_num_buckets,hist_ns_per_bucket] [-i interface] [-K] [-m msg_len] [-n num_msgs] [-r rate] [-s sleep_usec] [-T] [-w warmup_loops,warmup_rate] [-z zerocopy_bufs]";
 
 void usage(char *msg) {
   if (msg) fprintf(stderr, "%s\n", msg);
@@ -86,16 +148,21 @@ void help() {
   fprintf(stderr, "where:\n"
       "  -h : print help\n"
       "  -a affinity_cpu : bitmap for CPU affinity for send thread [%d]\n"
+      "  -c : connect() the socket to the group [%d]\n"
+      "  -e engine[,batch] : send engine (sendmsg, sendmmsg,batch, gso,batch, uring,batch[,sqpoll]) [%s]\n"
       "  -g group : multicast group address [%s]\n"
       "  -H hist_num_buckets,hist_ns_per_bucket : send time histogram [%s]\n"
       "  -i interface : interface for multicast bind [%s]\n"
+      "  -K : kernel TX timestamps for sock_perf_sub latency segments [%d]\n"
       "  -m msg_len : message length [%d]\n"
       "  -n num_msgs : number of messages to send [%d]\n"
       "  -r rate : messages per second to send [%d]\n"
       "  -s sleep_usec : microseconds to sleep between sends [%d]]\n"
+      "  -T : timestamp messages for subscriber latency [%d]\n"
       "  -w warmup_loops,warmup_rate : messages to send before measurement [%s]\n"
-      , o_affinity_cpu, o_group, o_histogram, o_interface, o_msg_len, o_num_msgs
-      , o_rate, o_sleep_usec, o_warmup
+      "  -z zerocopy_bufs : send with MSG_ZEROCOPY from a pool of buffers (0=no) [%d]\n"
+      , o_affinity_cpu, o_connect, o_engine, o_group, o_histogram, o_interface, o_kernel_ts, o_msg_len, o_num_msgs
+      , o_rate, o_sleep_usec, o_timestamp, o_warmup, o_zerocopy_bufs
   );
   CPRT_NET_CLEANUP;
   exit(0);
@@ -108,23 +175,29 @@ void get_my_opts(int argc, char **argv)
   int opt;  /* Loop variable for getopt(). */
 
   /* Set defaults for string options. */
+  o_engine = CPRT_STRDUP("sendmsg");
   o_group = CPRT_STRDUP("");
   o_histogram = CPRT_STRDUP("0,0");
   o_interface = CPRT_STRDUP("");
   o_warmup = CPRT_STRDUP("0,0");
 
-  while ((opt = cprt_getopt(argc, argv, "ha:g:H:i:m:n:r:s:w:")) != EOF) {
+  while ((opt = cprt_getopt(argc, argv, "ha:ce:g:H:i:Km:n:r:s:Tw:z:")) != EOF) {
     switch (opt) {
       case 'h': help(); break;
       case 'a': CPRT_ATOI(cprt_optarg, o_affinity_cpu); break;
+      case 'c': o_connect = 1; break;
+      case 'e': free(o_engine); o_engine = CPRT_STRDUP(cprt_optarg); break;
       case 'g': free(o_group); o_group = CPRT_STRDUP(cprt_optarg); break;
       case 'H': free(o_histogram); o_histogram = CPRT_STRDUP(cprt_optarg); break;
       case 'i': free(o_interface); o_interface = CPRT_STRDUP(cprt_optarg); break;
+      case 'K': o_kernel_ts = 1; break;
       case 'm': CPRT_ATOI(cprt_optarg, o_msg_len); break;
       case 'n': CPRT_ATOI(cprt_optarg, o_num_msgs); break;
       case 'r': CPRT_ATOI(cprt_optarg, o_rate); break;
       case 's': CPRT_ATOI(cprt_optarg, o_sleep_usec); break;
+      case 'T': o_timestamp = 1; break;
       case 'w': free(o_warmup); o_warmup = CPRT_STRDUP(cprt_optarg); break;
+      case 'z': CPRT_ATOI(cprt_optarg, o_zerocopy_bufs); break;
       default: usage(NULL);
     }  /* switch opt */
   }  /* while getopt */
@@ -134,7 +207,7 @@ void get_my_opts(int argc, char **argv)
 
   /* Must supply certain required "options". */
   ASSRT(o_num_msgs > 0);
-  ASSRT(o_msg_len > 0);
+  ASSRT(o_msg_len >= sizeof(perf_msg_t));
 
   char *strtok_context;
 
@@ -152,6 +225,67 @@ void get_my_opts(int argc, char **argv)
   free(work_str);
   if (hist_num_buckets > 0) { ASSRT(hist_ns_per_bucket > 0); }
 
+  /* Parse the engine option: "engine[,batch]". */
+  work_str = CPRT_STRDUP(o_engine);
+  char *engine_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(engine_str != NULL);
+  char *batch_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (strcmp(engine_str, "sendmsg") == 0) {
+    send_engine = ENGINE_SENDMSG;
+    ASSRT(batch_str == NULL);
+  }
+  else if (strcmp(engine_str, "sendmmsg") == 0) {
+    send_engine = ENGINE_SENDMMSG;
+    send_batch = 64;
+    if (batch_str != NULL) {
+      CPRT_ATOI(batch_str, send_batch);
+    }
+    ASSRT(send_batch > 0 && send_batch <= 1024);
+  }
+  else if (strcmp(engine_str, "gso") == 0) {
+    send_engine = ENGINE_GSO;
+    send_batch = 16;
+    if (batch_str != NULL) {
+      CPRT_ATOI(batch_str, send_batch);
+    }
+    ASSRT(send_batch > 0 && send_batch <= GSO_MAX_SEGS);
+  }
+  else if (strcmp(engine_str, "uring") == 0) {
+    send_engine = ENGINE_URING;
+    send_batch = 64;
+    if (batch_str != NULL) {
+      CPRT_ATOI(batch_str, send_batch);
+      char *sqpoll_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+      if (sqpoll_str != NULL) {
+        ASSRT(strcmp(sqpoll_str, "sqpoll") == 0);
+        uring_sqpoll = 1;
+      }
+    }
+    ASSRT(send_batch > 0 && send_batch <= 1024);
+  }
+  else {
+    usage("Error, -e engine must be sendmsg, sendmmsg, gso, or uring\n");
+  }
+  ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  free(work_str);
+  if (send_engine == ENGINE_GSO) {
+    ASSRT(o_msg_len * send_batch <= GSO_MAX_BYTES);
+  }
+
+  /* Zerocopy buffers are recycled by completion ID, modulo the pool size. */
+  if (o_zerocopy_bufs > 0) {
+    ASSRT(send_engine == ENGINE_SENDMSG || send_engine == ENGINE_SENDMMSG);
+    ASSRT((o_zerocopy_bufs & (o_zerocopy_bufs - 1)) == 0);  /* Power of 2. */
+    ASSRT(o_zerocopy_bufs >= send_batch);
+  }
+
+  /* Kernel TX timestamps are matched to messages by per-datagram ID. */
+  if (o_kernel_ts) {
+    ASSRT(send_engine == ENGINE_SENDMSG || send_engine == ENGINE_SENDMMSG);
+    ASSRT(o_zerocopy_bufs == 0);
+    ASSRT(o_msg_len >= sizeof(perf_msg_t) + sizeof(perf_kernel_ts_t));
+  }
+
   /* Parse the group option. */
   ASSRT(strlen(o_group) > 0);
   memset((char *)&group_in, 0, sizeof(group_in));
@@ -182,18 +316,18 @@ void get_my_opts(int argc, char **argv)
 
 /* Histogram. */
 int *hist_buckets = NULL;
-int hist_min_sample = 999999999;
-int hist_max_sample = 0;
-int hist_overflows = 0;  /* Number of values above the last bucket. */
-int hist_num_samples = 0;
+uint64_t hist_min_sample = (uint64_t)-1;
+uint64_t hist_max_sample = 0;
+uint64_t hist_overflows = 0;  /* Number of values at or above the last bucket. */
+uint64_t hist_num_samples = 0;
 uint64_t hist_sample_sum = 0;
 
 void hist_init()
 {
   /* Re-initialize the data. */
-  hist_min_sample = 999999999;
+  hist_min_sample = (uint64_t)-1;
   hist_max_sample = 0;
-  hist_overflows = 0;  /* Number of values above the last bucket. */
+  hist_overflows = 0;
   hist_num_samples = 0;
   hist_sample_sum = 0;
 
@@ -211,7 +345,9 @@ void hist_create()
   hist_init();
 }  /* hist_create */
 
-void hist_input(int in_sample)
+/* Samples are 64-bit, so that long send times are counted as overflows
+ * instead of wrapping negative. */
+void hist_input(uint64_t in_sample)
 {
   ASSRT(hist_buckets != NULL);
 
@@ -225,8 +361,8 @@ void hist_input(int in_sample)
     hist_min_sample = in_sample;
   }
 
-  int bucket = in_sample / hist_ns_per_bucket;
-  if (bucket >= hist_num_buckets) {
+  uint64_t bucket = in_sample / (uint64_t)hist_ns_per_bucket;
+  if (bucket >= (uint64_t)hist_num_buckets) {
     hist_overflows++;
   }
   else {
@@ -240,11 +376,13 @@ void hist_print()
   for (i = 0; i < hist_num_buckets; i++) {
     printf("%d\n", hist_buckets[i]);
   }
-  printf("o_histogram=%s, hist_overflows=%d, hist_min_sample=%d, hist_max_sample=%d,\n",
-      o_histogram, hist_overflows, hist_min_sample, hist_max_sample);
-  uint64_t average_sample = hist_sample_sum / (uint64_t)hist_num_samples;
-  printf("hist_num_samples=%d, average_sample=%d,\n",
-      hist_num_samples, (int)average_sample);
+  printf("o_histogram=%s, hist_overflows=%"PRIu64", hist_min_sample=%"PRIu64", hist_max_sample=%"PRIu64",\n",
+      o_histogram, hist_overflows,
+      (hist_num_samples == 0) ? 0 : hist_min_sample, hist_max_sample);
+  uint64_t average_sample = (hist_num_samples == 0) ? 0 :
+      hist_sample_sum / hist_num_samples;
+  printf("hist_num_samples=%"PRIu64", average_sample=%"PRIu64",\n",
+      hist_num_samples, average_sample);
 }  /* hist_print */
 
 
@@ -256,43 +394,356 @@ void init_sock(int sock)
   char ttl = 15;
   CPRT_EOK0(setsockopt(sock, IPPROTO_IP, IP_MULTICAST_TTL,
       (char *)&ttl, sizeof(ttl)));
+
+  /* Set up destination group:port. */
+  memset(&dest_sin, 0, sizeof(dest_sin));
+  dest_sin.sin_family = AF_INET;
+  dest_sin.sin_addr.s_addr = group_in.s_addr;
+  dest_sin.sin_port = htons(12000);
+
+  /* A connected socket skips the per-send route lookup. */
+  if (o_connect) {
+    CPRT_EOK0(connect(sock, (struct sockaddr *)&dest_sin, sizeof(dest_sin)));
+  }
+
+  /* With UDP_SEGMENT set, the kernel splits each send into o_msg_len
+   * datagrams. Fall back to sendmmsg if the kernel doesn't have it. */
+  if (send_engine == ENGINE_GSO) {
+    int gso_size = o_msg_len;
+    if (setsockopt(sock, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)) != 0) {
+      fprintf(stderr, "WARNING: UDP_SEGMENT not supported (%s), using sendmmsg\n",
+          strerror(errno));
+      send_engine = ENGINE_SENDMMSG;
+    }
+  }
+
+  if (o_zerocopy_bufs > 0) {
+    int opt_enable = 1;
+    if (setsockopt(sock, SOL_SOCKET, SO_ZEROCOPY, &opt_enable, sizeof(opt_enable)) != 0) {
+      fprintf(stderr, "WARNING: SO_ZEROCOPY not supported (%s), copying\n",
+          strerror(errno));
+    }
+    else {
+      zc_send_flags = MSG_ZEROCOPY;
+    }
+  }
+
+  if (o_kernel_ts) {
+    int ts_flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+        SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    CPRT_EOK0(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &ts_flags, sizeof(ts_flags)));
+  }
+
+  /* The socket is registered with the ring (fixed file 0), which saves the
+   * kernel a file table lookup per SQE. */
+  if (send_engine == ENGINE_URING) {
+    CPRT_EM1(sock_uring_init(&uring, send_batch,
+        uring_sqpoll ? IORING_SETUP_SQPOLL : 0));
+    CPRT_EM1(sock_uring_register_files(&uring, &sock, 1));
+  }
 }  /* init_sock */
 
 
+/* Allocate send_batch cache-aligned message buffers, each with its own
+ * msghdr, so that a batch can be handed to sendmmsg() in one call. For GSO,
+ * the buffers are packed back-to-back to form the super-buffer. */
+void msgs_create()
+{
+  size_t buf_size = (o_msg_len + CACHE_LINE_SIZE - 1) & ~(CACHE_LINE_SIZE - 1);
+  int i;
+
+  if (send_engine == ENGINE_GSO) {
+    buf_size = o_msg_len;
+  }
+  msg_buf_size = buf_size;
+
+  ASSRT(posix_memalign((void **)&msg_bufs, CACHE_LINE_SIZE,
+      buf_size * send_batch) == 0);
+  mmsgs = (struct mmsghdr *)calloc(send_batch, sizeof(struct mmsghdr));
+  ASSRT(mmsgs != NULL);
+  msg_iovs = (struct iovec *)calloc(send_batch, sizeof(struct iovec));
+  ASSRT(msg_iovs != NULL);
+
+  for (i = 0; i < send_batch; i++) {
+    char *buf = &msg_bufs[i * buf_size];
+    CPRT_SNPRINTF(buf, o_msg_len - 1, "sock_perf_pub,sock_perf_pub,sock_perf_pub,sock_perf_pub,");
+    msg_iovs[i].iov_base = buf;
+    msg_iovs[i].iov_len = o_msg_len;
+    if (! o_connect) {
+      mmsgs[i].msg_hdr.msg_name = &dest_sin;
+      mmsgs[i].msg_hdr.msg_namelen = sizeof(dest_sin);
+    }
+    mmsgs[i].msg_hdr.msg_iov = &msg_iovs[i];
+    mmsgs[i].msg_hdr.msg_iovlen = 1;
+  }
+  perf_msg = (perf_msg_t *)msg_bufs;
+
+  gso_iov.iov_base = msg_bufs;
+  gso_hdr = mmsgs[0].msg_hdr;
+  gso_hdr.msg_iov = &gso_iov;
+  gso_hdr.msg_iovlen = 1;
+
+  if (o_zerocopy_bufs > 0) {
+    ASSRT(posix_memalign((void **)&zc_pool, CACHE_LINE_SIZE,
+        buf_size * o_zerocopy_bufs) == 0);
+    zc_busy = (uint8_t *)calloc(o_zerocopy_bufs, sizeof(uint8_t));
+    ASSRT(zc_busy != NULL);
+    for (i = 0; i < o_zerocopy_bufs; i++) {
+      CPRT_SNPRINTF(&zc_pool[i * buf_size], o_msg_len - 1, "sock_perf_pub,sock_perf_pub,sock_perf_pub,sock_perf_pub,");
+    }
+  }
+}  /* msgs_create */
+
+
+/* Reap zerocopy completions from the socket's error queue, freeing their
+ * pool buffers. Does not block. */
+void zc_reap(int sock)
+{
+  char control[128];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  while (1) {
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      CPRT_PERRNO("recvmsg MSG_ERRQUEUE");
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      struct sock_extended_err *serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+      if (cmsg->cmsg_level != SOL_IP || cmsg->cmsg_type != IP_RECVERR ||
+          serr->ee_origin != SO_EE_ORIGIN_ZEROCOPY || serr->ee_errno != 0) {
+        continue;
+      }
+      /* IDs ee_info through ee_data (inclusive) are complete. */
+      uint32_t num_ids = serr->ee_data - serr->ee_info + 1;
+      uint32_t id;
+      for (id = serr->ee_info; id != serr->ee_data + 1; id++) {
+        zc_busy[id & (o_zerocopy_bufs - 1)] = 0;
+      }
+      zc_completions += num_ids;
+      if (serr->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+        zc_copied += num_ids;
+      }
+    }
+  }
+}  /* zc_reap */
+
+
+/* A zerocopy send fails with ENOBUFS when the socket's option memory is
+ * full of unreaped completions. Returns 1 if the send should be retried. */
+int zc_retry(int sock)
+{
+  if (zc_send_flags == 0 || errno != ENOBUFS) {
+    return 0;
+  }
+  zc_reap(sock);
+  return 1;
+}  /* zc_retry */
+
+
+/* Wait (up to 1 second) for the kernel to release all pool buffers. */
+void zc_drain(int sock)
+{
+  struct timespec start_ts;
+  struct timespec cur_ts;
+  uint64_t ns;
+  int i;
+
+  CPRT_GETTIME(&start_ts);
+  for (i = 0; i < o_zerocopy_bufs; i++) {
+    while (zc_busy[i]) {
+      zc_reap(sock);
+      CPRT_GETTIME(&cur_ts);
+      CPRT_DIFF_TS(ns, cur_ts, start_ts);
+      if (ns > 1000000000) {
+        fprintf(stderr, "WARNING: zerocopy completions missing\n");
+        return;
+      }
+    }
+  }
+}  /* zc_drain */
+
+
+/* Reap kernel TX timestamps from the socket's error queue, keeping the
+ * latest for the next message to carry. Does not block. */
+void kts_reap(int sock)
+{
+  char control[256];
+  struct msghdr msg;
+  struct cmsghdr *cmsg;
+
+  while (1) {
+    struct timespec *tx_ts = NULL;
+    struct sock_extended_err *serr = NULL;
+
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    num_syscalls++;
+    if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        return;
+      }
+      CPRT_PERRNO("recvmsg MSG_ERRQUEUE");
+    }
+
+    for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+      if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+        tx_ts = &((struct scm_timestamping *)CMSG_DATA(cmsg))->ts[0];  /* Software. */
+      }
+      else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+        serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+      }
+    }
+    if (tx_ts != NULL && serr != NULL && serr->ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+      kts_last_msg_num = serr->ee_data;
+      kts_last_tx_ts = *tx_ts;
+      kts_num_tx_ts++;
+    }
+  }
+}  /* kts_reap */
+
+
+/* Fill in the headers of the next num_msgs messages. */
+void msgs_build(int sock, int num_msgs, uint64_t msg_flags)
+{
+  int i;
+
+  if (msg_flags & FLAGS_KERNEL_TS) {
+    kts_reap(sock);
+  }
+
+  for (i = 0; i < num_msgs; i++) {
+    if (zc_send_flags != 0) {
+      int buf_index = (zc_next_id + i) & (o_zerocopy_bufs - 1);
+      if (zc_busy[buf_index]) {
+        zc_waits++;
+        do {
+          zc_reap(sock);
+        } while (zc_busy[buf_index]);
+      }
+      zc_busy[buf_index] = 1;
+      msg_iovs[i].iov_base = &zc_pool[buf_index * msg_buf_size];
+    }
+    perf_msg_t *msg = (perf_msg_t *)msg_iovs[i].iov_base;
+    msg->msg_num = total_sends + i;
+    msg->flags = msg_flags;
+    if (msg_flags & FLAGS_KERNEL_TS) {
+      perf_kernel_ts_t *kernel_ts = (perf_kernel_ts_t *)(msg + 1);
+      kernel_ts->tx_msg_num = kts_last_msg_num;
+      kernel_ts->tx_ts = kts_last_tx_ts;
+      clock_gettime(CLOCK_REALTIME, &msg->send_ts);
+    }
+    else if (msg_flags & FLAGS_TIMESTAMP) {
+      CPRT_GETTIME(&msg->send_ts);
+    }
+  }
+}  /* msgs_build */
+
+
+/* Send the first num_msgs buffers. */
+void msgs_send(int sock, int num_msgs)
+{
+  int num_sent = 0;
+
+  if (send_engine == ENGINE_SENDMSG) {
+    int rtn;
+    do {
+      rtn = sendmsg(sock, &mmsgs[0].msg_hdr, zc_send_flags);
+      num_syscalls++;
+    } while (rtn == -1 && zc_retry(sock));
+    CPRT_EM1(rtn);
+    zc_next_id++;
+    return;
+  }
+
+  if (send_engine == ENGINE_GSO) {
+    gso_iov.iov_len = num_msgs * o_msg_len;
+    num_syscalls++;
+    if (sendmsg(sock, &gso_hdr, 0) != -1) {
+      return;
+    }
+    /* E.g. EIO if the device can't checksum the segments. */
+    fprintf(stderr, "WARNING: UDP_SEGMENT send failed (%s), using sendmmsg\n",
+        strerror(errno));
+    int gso_size = 0;
+    CPRT_EOK0(setsockopt(sock, SOL_UDP, UDP_SEGMENT, &gso_size, sizeof(gso_size)));
+    send_engine = ENGINE_SENDMMSG;
+  }
+
+  if (send_engine == ENGINE_URING) {
+    uint64_t prev_enters = uring.num_enters;
+    struct io_uring_cqe *cqe;
+    int i;
+
+    for (i = 0; i < num_msgs; i++) {
+      struct io_uring_sqe *sqe = sock_uring_get_sqe(&uring);
+      ASSRT(sqe != NULL);
+      sqe->opcode = IORING_OP_SENDMSG;
+      sqe->flags = IOSQE_FIXED_FILE;
+      sqe->fd = 0;
+      sqe->addr = (uint64_t)(uintptr_t)&mmsgs[i].msg_hdr;
+      sqe->len = 1;
+      sqe->user_data = i;
+    }
+    /* Wait for all completions; the buffers are reused for the next batch. */
+    CPRT_EM1(sock_uring_submit_and_wait(&uring, num_msgs, -1));
+    while (num_sent < num_msgs) {
+      cqe = sock_uring_peek_cqe(&uring);
+      if (cqe == NULL) {
+        CPRT_EM1(sock_uring_submit_and_wait(&uring, num_msgs - num_sent, -1));
+        continue;
+      }
+      if (cqe->res < 0) {
+        fprintf(stderr, "ERROR: io_uring sendmsg: %s\n", strerror(-cqe->res));
+        exit(1);
+      }
+      sock_uring_cqe_seen(&uring);
+      num_sent++;
+    }
+    num_syscalls += uring.num_enters - prev_enters;
+    return;
+  }
+
+  /* A blocking sendmmsg() only returns short on error. */
+  while (num_sent < num_msgs) {
+    int rtn = sendmmsg(sock, &mmsgs[num_sent], num_msgs - num_sent, zc_send_flags);
+    num_syscalls++;
+    if (rtn == -1 && zc_retry(sock)) {
+      continue;
+    }
+    CPRT_EM1(rtn);
+    num_sent += rtn;
+  }
+  zc_next_id += num_msgs;
+}  /* msgs_send */
+
+
 int send_loop(int sock, int num_sends, uint64_t sends_per_sec)
 {
   struct timespec cur_ts;
   struct timespec start_ts;
   uint64_t num_sent;
   int max_tight_sends;
-  struct sockaddr_in dest_sin;
-  struct msghdr message_hdr;
-  struct iovec message_iov;
-
-  /* Set up destination group:port. */
-  memset(&dest_sin, 0, sizeof(dest_sin));
-  dest_sin.sin_family = AF_INET;
-  dest_sin.sin_addr.s_addr = group_in.s_addr;
-  dest_sin.sin_port = htons(12000);
-
-  /* Set up outgoing message buffer. */
-  message_iov.iov_base = perf_msg;
-  message_iov.iov_len = o_msg_len;
-
-  /* Set up call to sendmsg(). */
-  message_hdr.msg_name = &dest_sin;
-  message_hdr.msg_namelen = sizeof(dest_sin);
-  message_hdr.msg_iov = &message_iov;
-  message_hdr.msg_iovlen = 1;
-  message_hdr.msg_control = NULL;
-  message_hdr.msg_controllen = 0;
-  message_hdr.msg_flags = 0;
 
   /* Set up local variable so that test is fast. */
   int do_histogram = 0;
   if (hist_buckets != NULL) {
       do_histogram = 1;
   }
+  uint64_t msg_flags = 0;
+  if (o_timestamp) {
+    msg_flags |= FLAGS_TIMESTAMP;
+  }
+  if (o_kernel_ts) {
+    msg_flags |= FLAGS_TIMESTAMP | FLAGS_KERNEL_TS;
+  }
 
   max_tight_sends = 0;
 
@@ -314,28 +765,33 @@ int send_loop(int sock, int num_sends, uint64_t sends_per_sec)
         max_tight_sends = should_have_sent - num_sent;
       }
 
-      /* If we are behind where we should be, get caught up. */
+      /* If we are behind where we should be, get caught up. The sendmmsg
+       * engine sends all due messages (up to send_batch) in one call. */
       while (num_sent < should_have_sent) {
-        /* Construct message. */
-        perf_msg->msg_num = num_sent;
-        perf_msg->flags = 0;
+        int num_msgs = should_have_sent - num_sent;
+        if (num_msgs > send_batch) {
+          num_msgs = send_batch;
+        }
+        /* Construct messages. */
+        msgs_build(sock, num_msgs, msg_flags);
 
         struct timespec send_start_ts;
         if (do_histogram) {
           CPRT_GETTIME(&send_start_ts);
         }
 
-        /* Send message. */
-        CPRT_EM1(sendmsg(sock, &message_hdr, 0));
+        /* Send messages. */
+        msgs_send(sock, num_msgs);
 
         if (do_histogram) {
           struct timespec send_return_ts;
           CPRT_GETTIME(&send_return_ts);
           uint64_t ns_send;
           CPRT_DIFF_TS(ns_send, send_return_ts, send_start_ts);
-          hist_input((int)ns_send);
+          hist_input(ns_send);
         }
-        num_sent++;
+        total_sends += num_msgs;
+        num_sent += num_msgs;
       }  /* while num_sent < should_have_sent */
       CPRT_GETTIME(&cur_ts);
     } while (num_sent < num_sends);
@@ -346,8 +802,7 @@ int send_loop(int sock, int num_sends, uint64_t sends_per_sec)
   if (o_sleep_usec > 0) {
     for (num_sent = 0; num_sent < num_sends; num_sent++) {
       /* Construct message. */
-      perf_msg->msg_num = num_sent;
-      perf_msg->flags = 0;
+      msgs_build(sock, 1, msg_flags);
 
       struct timespec send_start_ts;
       if (do_histogram) {
@@ -355,15 +810,16 @@ int send_loop(int sock, int num_sends, uint64_t sends_per_sec)
       }
 
       /* Send message. */
-      CPRT_EM1(sendmsg(sock, &message_hdr, 0));
+      msgs_send(sock, 1);
 
       if (do_histogram) {
         struct timespec send_return_ts;
         CPRT_GETTIME(&send_return_ts);
         uint64_t ns_send;
         CPRT_DIFF_TS(ns_send, send_return_ts, send_start_ts);
-        hist_input((int)ns_send);
+        hist_input(ns_send);
       }
+      total_sends++;
 
       usleep(o_sleep_usec);
     }
@@ -373,6 +829,34 @@ int send_loop(int sock, int num_sends, uint64_t sends_per_sec)
 }  /* send_loop */
 
 
+uint64_t rusage_cpu_ns(struct rusage *ru)
+{
+  return (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000
+      + (uint64_t)(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000;
+}  /* rusage_cpu_ns */
+
+
+/* Tell sock_perf_sub that the test is over. The marker is sent a few times
+ * in case of loss; the subscriber exits on the first one. */
+void send_eos(int sock)
+{
+  int i;
+
+  perf_msg->msg_num = total_sends;
+  perf_msg->flags = FLAGS_EOS;
+  for (i = 0; i < 3; i++) {
+    usleep(10000);
+    if (o_connect) {
+      CPRT_EM1(send(sock, perf_msg, sizeof(perf_msg_t), 0));
+    }
+    else {
+      CPRT_EM1(sendto(sock, perf_msg, sizeof(perf_msg_t), 0,
+          (struct sockaddr *)&dest_sin, sizeof(dest_sin)));
+    }
+  }
+}  /* send_eos */
+
+
 int main(int argc, char **argv)
 {
   int sock;
@@ -382,6 +866,9 @@ int main(int argc, char **argv)
   uint64_t duration_ns;
   int actual_sends;
   double result_rate;
+  struct rusage start_rusage;
+  struct rusage end_rusage;
+  uint64_t cpu_ns;  /* User plus system CPU time of the measurement loop. */
   CPRT_NET_START;
 
   CPRT_INITTIME();
@@ -393,11 +880,10 @@ int main(int argc, char **argv)
   }
 
   /* Leave "comma space" at end of line to make parsing output easier. */
-  printf("o_affinity_cpu=%d, o_group=%s, o_histogram=%s, o_interface=%s, o_msg_len=%d, o_num_msgs=%d, o_rate=%d, o_sleep_usec=%d, o_warmup=%s, \n",
-      o_affinity_cpu, o_group, o_histogram, o_interface, o_msg_len, o_num_msgs, o_rate, o_sleep_usec, o_warmup);
+  printf("o_affinity_cpu=%d, o_connect=%d, o_engine=%s, o_group=%s, o_histogram=%s, o_interface=%s, o_kernel_ts=%d, o_msg_len=%d, o_num_msgs=%d, o_rate=%d, o_sleep_usec=%d, o_timestamp=%d, o_warmup=%s, o_zerocopy_bufs=%d, \n",
+      o_affinity_cpu, o_connect, o_engine, o_group, o_histogram, o_interface, o_kernel_ts, o_msg_len, o_num_msgs, o_rate, o_sleep_usec, o_timestamp, o_warmup, o_zerocopy_bufs);
 
-  perf_msg = (perf_msg_t *)malloc(o_msg_len);
-  CPRT_SNPRINTF((char *)perf_msg, o_msg_len - 1, "sock_perf_pub,sock_perf_pub,sock_perf_pub,sock_perf_pub,");
+  msgs_create();
 
   /* Pin time-critical thread (sending thread) to requested CPU core. */
   if (o_affinity_cpu > -1) {
@@ -420,10 +906,19 @@ int main(int argc, char **argv)
   if (hist_buckets != NULL) {
     hist_init();  /* Zero out data from warmup period. */
   }
+  num_syscalls = 0;
+  CPRT_EOK0(getrusage(RUSAGE_SELF, &start_rusage));
   CPRT_GETTIME(&start_ts);
   actual_sends = send_loop(sock, o_num_msgs, o_rate);
   CPRT_GETTIME(&end_ts);
+  CPRT_EOK0(getrusage(RUSAGE_SELF, &end_rusage));
   CPRT_DIFF_TS(duration_ns, end_ts, start_ts);
+  if (zc_send_flags != 0) {
+    zc_drain(sock);
+  }
+  cpu_ns = rusage_cpu_ns(&end_rusage) - rusage_cpu_ns(&start_rusage);
+
+  send_eos(sock);
 
   result_rate = (double)(duration_ns);
   result_rate /= (double)1000000000;
@@ -435,10 +930,26 @@ int main(int argc, char **argv)
   }
 
   /* Leave "comma space" at end of line to make parsing output easier. */
-  printf("actual_sends=%d, duration_ns=%"PRIu64", result_rate=%f, global_max_tight_sends=%d\n",
-      actual_sends, duration_ns, result_rate, global_max_tight_sends);
+  printf("actual_sends=%d, duration_ns=%"PRIu64", result_rate=%f, global_max_tight_sends=%d, syscalls=%"PRIu64", syscalls_per_msg=%f, cpu_ns_per_msg=%f, \n",
+      actual_sends, duration_ns, result_rate, global_max_tight_sends,
+      num_syscalls, (double)num_syscalls / (double)actual_sends,
+      (double)cpu_ns / (double)actual_sends);
 
-  free(perf_msg);
+  if (o_kernel_ts) {
+    printf("kernel_tx_timestamps=%"PRIu64", \n", kts_num_tx_ts);
+  }
+  if (zc_send_flags != 0) {
+    printf("zerocopy_sends=%u, zerocopy_completions=%"PRIu64", zerocopy_copied=%"PRIu64", zerocopy_waits=%"PRIu64", \n",
+        zc_next_id, zc_completions, zc_copied, zc_waits);
+    free(zc_pool);
+    free(zc_busy);
+  }
+  if (send_engine == ENGINE_URING) {
+    sock_uring_exit(&uring);
+  }
+  free(mmsgs);
+  free(msg_iovs);
+  free(msg_bufs);
 
   CPRT_NET_CLEANUP;
   return 0;
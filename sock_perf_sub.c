@@ -30,6 +30,7 @@
  * However, due to the differences between the Linux and Windows socket
  * APIs, no attempt is made to make sock_perf_pub portible to Windows.
  */
+#define _GNU_SOURCE  /* For recvmmsg(). */
 #include "cprt.h"
 
 #include <stdio.h>
@@ -39,35 +40,97 @@
 #if ! defined(_WIN32)
   #include <sys/types.h>
   #include <sys/socket.h>
+  #include <sys/resource.h>
   #include <netdb.h>
   #include <netinet/in.h>
+  #include <netinet/udp.h>
+  #include <linux/sock_diag.h>
+  #include <linux/filter.h>
   #include <arpa/inet.h>
   #include <stdlib.h>
   #include <unistd.h>
 #endif
 
 #include "um_perf.h"
+#include "sock_uring.h"
+
+#ifndef UDP_GRO
+#define UDP_GRO 104  /* Linux 5.0+; missing from older libc headers. */
+#endif
+#ifndef SO_MEMINFO
+#define SO_MEMINFO 55  /* Linux 4.6+. */
+#endif
+#ifndef SO_ATTACH_REUSEPORT_CBPF
+#define SO_ATTACH_REUSEPORT_CBPF 51  /* Linux 4.5+. */
+#endif
 
 
 /* Command-line options and their defaults. String defaults are set
  * in "get_my_opts()".
  */
 static int o_affinity_cpu = -1;
+static int o_drops = 0;  /* -D */
+static char *o_engine = NULL;  /* -e */
 static char *o_group = NULL;
 static char *o_histogram = NULL;  /* -H */
 static char *o_interface = NULL;
+static int o_kernel_ts = 0;  /* -K */
+static char *o_threads = NULL;  /* -N */
+static int o_stats_ms = 0;  /* -I */
+static int o_idle_ms = 5000;  /* -t */
 
 /* Parameters parsed out from command-line options. */
 int hist_num_buckets;
 int hist_ns_per_bucket;
 struct in_addr iface_in;
 struct in_addr group_in;
+#define ENGINE_RECVFROM 0  /* One recvfrom() per epoll wakeup. */
+#define ENGINE_RECVMMSG 1  /* recvmmsg() batches until EAGAIN. */
+#define ENGINE_GRO 2       /* recvmsg() of coalesced datagrams until EAGAIN. */
+#define ENGINE_URING 3     /* io_uring multishot recvmsg, provided buffers. */
+#define GRO_MAX_SEGS 128   /* Kernel's UDP_MAX_SEGMENTS (newer kernels). */
+int rcv_engine;
+int rcv_batch = 1;
+int group_is_mcast;
+int num_threads;
+int thread_first_cpu = -1;
+#define STEER_NONE 0  /* Kernel's SO_REUSEPORT hash of the address/port 4-tuple. */
+#define STEER_CPU 1   /* CBPF: CPU that processed the datagram, mod num_threads. */
+#define STEER_HASH 2  /* CBPF: skb flow hash, mod num_threads. */
+int rcv_steer;
 
 #define MAXEVENTS 8
-/* Globals. The code depends on the loader initializing them to all zeros. */
-
-
-char usage_str[] = "Usage: sock_perf_sub [-h] [-a affinity_cpu] [-g group] [-H hist_num_buckets,hist_ns_per_bucket] [-i interface]";
+/* Globals. The code depends on the loader initializing them to all zeros.
+ * The receive state is thread-local, so that each receive thread (-N) has
+ * its own; the main thread merges the threads' results at the end. */
+/* Receive statistics, by perf_msg_t msg_num. */
+__thread uint64_t num_rcv_msgs;
+__thread uint64_t num_short_msgs;  /* Too small to be a perf_msg_t. */
+__thread uint64_t num_gaps;
+__thread uint64_t num_lost_msgs;  /* Skipped over by gaps. */
+__thread uint64_t num_ooo_msgs;  /* Late, filling a gap. */
+__thread uint64_t num_dup_msgs;  /* Lower than expected, but not missing. */
+__thread uint64_t num_timestamps;
+__thread uint64_t num_neg_latencies;  /* Receive time before send time (clocks not synced). */
+__thread uint64_t min_latency = (uint64_t)-1;  /* max int */
+__thread uint64_t max_latency;
+__thread uint64_t sum_latencies;
+__thread uint64_t interval_max_latency;
+__thread uint64_t num_syscalls;  /* epoll_wait() and receive calls. */
+__thread struct timespec first_rcv_ts;
+__thread struct timespec last_rcv_ts;
+/* Set by the first message to any thread (starts the others' idle timers). */
+volatile int any_rcv_started;
+
+/* With -K, receive times are CLOCK_REALTIME, like the kernel's timestamps
+ * and the publisher's send_ts. */
+#define RCV_GETTIME(ts_) do { \
+  if (o_kernel_ts) clock_gettime(CLOCK_REALTIME, (ts_)); \
+  else CPRT_GETTIME(ts_); \
+} while (0)  /* RCV_GETTIME */
+
+
+char usage_str[] = "Usage: sock_perf_sub [-h] [-a affinity_cpu] [-D] [-e engine[,batch]] [-g group] [-H hist_num_buckets,hist_ns_per_bucket] [-i interface] [-I stats_ms] [-K] [-N num_threads[,first_cpu[,steer]]] [-t idle_ms]";
 
 void usage(char *msg) {
   if (msg) fprintf(stderr, "%s\n", msg);
@@ -81,10 +144,16 @@ void help() {
   fprintf(stderr, "where:\n"
       "  -h : print help\n"
       "  -a affinity_cpu : bitmap for CPU affinity for send thread [%d]\n"
-      "  -g group : multicast group address [%s]\n"
-      "  -H hist_num_buckets,hist_ns_per_bucket : send time histogram [%s]\n"
+      "  -D : kernel drop counts and receive queue depth [%d]\n"
+      "  -e engine[,batch] : receive engine (recvfrom, recvmmsg,batch, gro, uring,num_bufs) [%s]\n"
+      "  -g group : multicast (or, for -N, unicast) group address [%s]\n"
+      "  -H hist_num_buckets,hist_ns_per_bucket : latency histogram [%s]\n"
       "  -i interface : interface for multicast bind [%s]\n"
-      , o_affinity_cpu, o_group, o_histogram, o_interface
+      "  -I stats_ms : interval statistics period (0=none) [%d]\n"
+      "  -K : kernel RX timestamps and latency segments (needs sock_perf_pub -K) [%d]\n"
+      "  -N num_threads[,first_cpu[,steer]] : SO_REUSEPORT receive threads, steer=none, cpu, or hash [%s]\n"
+      "  -t idle_ms : exit if no messages for idle_ms after the first (0=never) [%d]\n"
+      , o_affinity_cpu, o_drops, o_engine, o_group, o_histogram, o_interface, o_stats_ms, o_kernel_ts, o_threads, o_idle_ms
   );
   CPRT_NET_CLEANUP;
   exit(0);
@@ -97,17 +166,25 @@ void get_my_opts(int argc, char **argv)
   int opt;  /* Loop variable for getopt(). */
 
   /* Set defaults for string options. */
+  o_engine = CPRT_STRDUP("recvfrom");
   o_group = CPRT_STRDUP("");
   o_histogram = CPRT_STRDUP("0,0");
   o_interface = CPRT_STRDUP("");
+  o_threads = CPRT_STRDUP("1");
 
-  while ((opt = cprt_getopt(argc, argv, "ha:g:H:i:")) != EOF) {
+  while ((opt = cprt_getopt(argc, argv, "ha:De:g:H:i:I:KN:t:")) != EOF) {
     switch (opt) {
       case 'h': help(); break;
       case 'a': CPRT_ATOI(cprt_optarg, o_affinity_cpu); break;
+      case 'D': o_drops = 1; break;
+      case 'e': free(o_engine); o_engine = CPRT_STRDUP(cprt_optarg); break;
       case 'g': free(o_group); o_group = CPRT_STRDUP(cprt_optarg); break;
       case 'H': free(o_histogram); o_histogram = CPRT_STRDUP(cprt_optarg); break;
       case 'i': free(o_interface); o_interface = CPRT_STRDUP(cprt_optarg); break;
+      case 'I': CPRT_ATOI(cprt_optarg, o_stats_ms); break;
+      case 'K': o_kernel_ts = 1; break;
+      case 'N': free(o_threads); o_threads = CPRT_STRDUP(cprt_optarg); break;
+      case 't': CPRT_ATOI(cprt_optarg, o_idle_ms); break;
       default: usage(NULL);
     }  /* switch opt */
   }  /* while getopt */
@@ -116,6 +193,7 @@ void get_my_opts(int argc, char **argv)
   ASSRT(strlen(o_group) > 0);
   memset((char *)&group_in, 0, sizeof(group_in));
   ASSRT(inet_aton(o_group, &group_in) != 0);
+  group_is_mcast = IN_MULTICAST(ntohl(group_in.s_addr));
 
   char *strtok_context;
 
@@ -133,29 +211,103 @@ void get_my_opts(int argc, char **argv)
   free(work_str);
   if (hist_num_buckets > 0) { ASSRT(hist_ns_per_bucket > 0); }
 
-  /* Parse the interface option. */
-  ASSRT(strlen(o_interface) > 0);
+  /* Parse the engine option: "engine[,batch]". */
+  work_str = CPRT_STRDUP(o_engine);
+  char *engine_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(engine_str != NULL);
+  char *batch_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (strcmp(engine_str, "recvfrom") == 0) {
+    rcv_engine = ENGINE_RECVFROM;
+    ASSRT(batch_str == NULL);
+  }
+  else if (strcmp(engine_str, "recvmmsg") == 0) {
+    rcv_engine = ENGINE_RECVMMSG;
+    rcv_batch = 100;  /* Like UM's multiple_receive_maximum_datagrams in um.xml. */
+    if (batch_str != NULL) {
+      CPRT_ATOI(batch_str, rcv_batch);
+    }
+    ASSRT(rcv_batch > 0 && rcv_batch <= 1024);
+  }
+  else if (strcmp(engine_str, "gro") == 0) {
+    rcv_engine = ENGINE_GRO;
+    rcv_batch = GRO_MAX_SEGS;  /* For the batch size histogram. */
+    ASSRT(batch_str == NULL);
+  }
+  else if (strcmp(engine_str, "uring") == 0) {
+    rcv_engine = ENGINE_URING;
+    rcv_batch = 256;
+    if (batch_str != NULL) {
+      CPRT_ATOI(batch_str, rcv_batch);
+    }
+    /* The provided buffer ring size must be a power of 2. */
+    ASSRT(rcv_batch > 0 && rcv_batch <= 32768 && (rcv_batch & (rcv_batch - 1)) == 0);
+  }
+  else {
+    usage("Error, -e engine must be recvfrom, recvmmsg, gro, or uring\n");
+  }
+  ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  free(work_str);
+  if (o_kernel_ts) {
+    ASSRT(rcv_engine == ENGINE_RECVFROM || rcv_engine == ENGINE_RECVMMSG);
+  }
+  if (o_drops) {
+    ASSRT(rcv_engine != ENGINE_URING);
+  }
+
+  /* Parse the threads option: "num_threads[,first_cpu[,steer]]". */
+  work_str = CPRT_STRDUP(o_threads);
+  char *num_threads_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(num_threads_str != NULL);
+  CPRT_ATOI(num_threads_str, num_threads);
+  ASSRT(num_threads > 0 && num_threads <= 64);
+  char *thread_first_cpu_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (thread_first_cpu_str != NULL) {
+    CPRT_ATOI(thread_first_cpu_str, thread_first_cpu);
+  }
+  char *steer_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (steer_str == NULL || strcmp(steer_str, "none") == 0) {
+    rcv_steer = STEER_NONE;
+  }
+  else if (strcmp(steer_str, "cpu") == 0) {
+    rcv_steer = STEER_CPU;
+  }
+  else if (strcmp(steer_str, "hash") == 0) {
+    rcv_steer = STEER_HASH;
+  }
+  else {
+    usage("Error, -N steer must be none, cpu, or hash\n");
+  }
+  ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  free(work_str);
+  if (num_threads > 1) {
+    ASSRT(o_idle_ms > 0);  /* The only way the threads exit. */
+  }
+
+  /* Parse the interface option (only needed to join a multicast group). */
   memset((char *)&iface_in, 0, sizeof(iface_in));
-  ASSRT(inet_aton(o_interface, &iface_in) != 0);
+  if (group_is_mcast) {
+    ASSRT(strlen(o_interface) > 0);
+    ASSRT(inet_aton(o_interface, &iface_in) != 0);
+  }
 
   if (cprt_optind != argc) { usage("Unexpected positional parameter(s)"); }
 }  /* get_my_opts */
 
 
 /* Histogram. */
-int *hist_buckets = NULL;
-int hist_min_sample = 999999999;
-int hist_max_sample = 0;
-int hist_overflows = 0;  /* Number of values above the last bucket. */
-int hist_num_samples = 0;
-uint64_t hist_sample_sum = 0;
+__thread int *hist_buckets = NULL;
+__thread uint64_t hist_min_sample = (uint64_t)-1;
+__thread uint64_t hist_max_sample = 0;
+__thread uint64_t hist_overflows = 0;  /* Number of values at or above the last bucket. */
+__thread uint64_t hist_num_samples = 0;
+__thread uint64_t hist_sample_sum = 0;
 
 void hist_init()
 {
   /* Re-initialize the data. */
-  hist_min_sample = 999999999;
+  hist_min_sample = (uint64_t)-1;
   hist_max_sample = 0;
-  hist_overflows = 0;  /* Number of values above the last bucket. */
+  hist_overflows = 0;
   hist_num_samples = 0;
   hist_sample_sum = 0;
 
@@ -173,7 +325,9 @@ void hist_create()
   hist_init();
 }  /* hist_create */
 
-void hist_input(int in_sample)
+/* Samples are 64-bit, so that long latencies are counted as overflows
+ * instead of wrapping negative. */
+void hist_input(uint64_t in_sample)
 {
   ASSRT(hist_buckets != NULL);
 
@@ -187,8 +341,8 @@ void hist_input(int in_sample)
     hist_min_sample = in_sample;
   }
 
-  int bucket = in_sample / hist_ns_per_bucket;
-  if (bucket >= hist_num_buckets) {
+  uint64_t bucket = in_sample / (uint64_t)hist_ns_per_bucket;
+  if (bucket >= (uint64_t)hist_num_buckets) {
     hist_overflows++;
   }
   else {
@@ -202,15 +356,671 @@ void hist_print()
   for (i = 0; i < hist_num_buckets; i++) {
     printf("%d\n", hist_buckets[i]);
   }
-  printf("o_histogram=%s, hist_overflows=%d, hist_min_sample=%d, hist_max_sample=%d,\n",
-      o_histogram, hist_overflows, hist_min_sample, hist_max_sample);
-  uint64_t average_sample = hist_sample_sum / (uint64_t)hist_num_samples;
-  printf("hist_num_samples=%d, average_sample=%d,\n",
-      hist_num_samples, (int)average_sample);
+  printf("o_histogram=%s, hist_overflows=%"PRIu64", hist_min_sample=%"PRIu64", hist_max_sample=%"PRIu64",\n",
+      o_histogram, hist_overflows,
+      (hist_num_samples == 0) ? 0 : hist_min_sample, hist_max_sample);
+  uint64_t average_sample = (hist_num_samples == 0) ? 0 :
+      hist_sample_sum / hist_num_samples;
+  printf("hist_num_samples=%"PRIu64", average_sample=%"PRIu64",\n",
+      hist_num_samples, average_sample);
 }  /* hist_print */
 
 
-void init_sock(int sock)
+/* Kernel timestamp latency segments (-K), using the -H bucket settings:
+ * publisher app to kernel TX, kernel TX to kernel RX, and kernel RX to
+ * subscriber app. */
+#define KTS_APP_TO_KERNEL 0
+#define KTS_KERNEL_TO_KERNEL 1
+#define KTS_KERNEL_TO_APP 2
+#define KTS_NUM_SEGS 3
+struct kts_hist_s {
+  char *name;
+  int *buckets;
+  int overflows;
+  uint64_t num_samples;
+  uint64_t sample_sum;
+  uint64_t min_sample;
+  uint64_t max_sample;
+  uint64_t negatives;  /* Clock skew between hosts. */
+};
+__thread struct kts_hist_s kts_hists[KTS_NUM_SEGS] = {
+  { "app_to_kernel" }, { "kernel_to_kernel" }, { "kernel_to_app" }
+};
+/* The publisher's TX timestamp for a message arrives with a later message,
+ * so the send and RX timestamps of recent messages are kept, by msg_num. */
+#define KTS_RING_SIZE 65536  /* Power of 2. */
+struct kts_slot_s {
+  uint64_t msg_num;  /* (uint64_t)-1 if empty or used. */
+  struct timespec send_ts;
+  struct timespec krx_ts;
+};
+__thread struct kts_slot_s *kts_ring;
+__thread uint64_t num_krx_missing;  /* Datagrams without a kernel RX timestamp. */
+
+void kts_create()
+{
+  int seg, i;
+
+  for (seg = 0; seg < KTS_NUM_SEGS; seg++) {
+    kts_hists[seg].min_sample = (uint64_t)-1;
+    if (hist_num_buckets > 0) {
+      kts_hists[seg].buckets = (int *)calloc(hist_num_buckets, sizeof(int));
+      ASSRT(kts_hists[seg].buckets != NULL);
+    }
+  }
+  kts_ring = (struct kts_slot_s *)malloc(KTS_RING_SIZE * sizeof(struct kts_slot_s));
+  ASSRT(kts_ring != NULL);
+  for (i = 0; i < KTS_RING_SIZE; i++) {
+    kts_ring[i].msg_num = (uint64_t)-1;
+  }
+}  /* kts_create */
+
+void kts_input(int seg, struct timespec *end_ts, struct timespec *start_ts)
+{
+  struct kts_hist_s *hist = &kts_hists[seg];
+  int64_t sample = ((int64_t)end_ts->tv_sec - (int64_t)start_ts->tv_sec) * 1000000000
+      + ((int64_t)end_ts->tv_nsec - (int64_t)start_ts->tv_nsec);
+
+  if (sample < 0) {
+    hist->negatives++;
+    return;
+  }
+  hist->num_samples++;
+  hist->sample_sum += sample;
+  if (sample < hist->min_sample) hist->min_sample = sample;
+  if (sample > hist->max_sample) hist->max_sample = sample;
+  if (hist->buckets != NULL) {
+    uint64_t bucket = sample / hist_ns_per_bucket;
+    if (bucket >= hist_num_buckets) {
+      hist->overflows++;
+    }
+    else {
+      hist->buckets[bucket]++;
+    }
+  }
+}  /* kts_input */
+
+void kts_msg_input(perf_msg_t *perf_msg, struct timespec *rcv_ts, struct timespec *krx_ts)
+{
+  perf_kernel_ts_t *kernel_ts = (perf_kernel_ts_t *)(perf_msg + 1);
+  struct kts_slot_s *slot;
+
+  if (krx_ts == NULL) {
+    num_krx_missing++;
+    return;
+  }
+  kts_input(KTS_KERNEL_TO_APP, rcv_ts, krx_ts);
+
+  slot = &kts_ring[perf_msg->msg_num & (KTS_RING_SIZE - 1)];
+  slot->msg_num = perf_msg->msg_num;
+  slot->send_ts = perf_msg->send_ts;
+  slot->krx_ts = *krx_ts;
+
+  /* Several messages can carry the same TX timestamp; use it once. */
+  slot = &kts_ring[kernel_ts->tx_msg_num & (KTS_RING_SIZE - 1)];
+  if (kernel_ts->tx_msg_num != (uint64_t)-1 && slot->msg_num == kernel_ts->tx_msg_num) {
+    kts_input(KTS_APP_TO_KERNEL, &kernel_ts->tx_ts, &slot->send_ts);
+    kts_input(KTS_KERNEL_TO_KERNEL, &slot->krx_ts, &kernel_ts->tx_ts);
+    slot->msg_num = (uint64_t)-1;
+  }
+}  /* kts_msg_input */
+
+void kts_print()
+{
+  int seg, i;
+
+  for (seg = 0; seg < KTS_NUM_SEGS; seg++) {
+    struct kts_hist_s *hist = &kts_hists[seg];
+    if (hist->buckets != NULL) {
+      for (i = 0; i < hist_num_buckets; i++) {
+        printf("%d\n", hist->buckets[i]);
+      }
+    }
+    printf("segment=%s, samples=%"PRIu64", min_ns=%"PRIu64", max_ns=%"PRIu64", average_ns=%"PRIu64", overflows=%d, negatives=%"PRIu64", \n",
+        hist->name, hist->num_samples,
+        (hist->num_samples == 0) ? 0 : hist->min_sample, hist->max_sample,
+        (hist->num_samples == 0) ? 0 : hist->sample_sum / hist->num_samples,
+        hist->overflows, hist->negatives);
+  }
+  printf("krx_missing=%"PRIu64", \n", num_krx_missing);
+}  /* kts_print */
+
+/* Kernel drops and receive queue depth (-D). The SO_RXQ_OVFL control
+ * message carries the socket's cumulative drop count (it is only present
+ * once there have been drops). The queue depth is the socket's receive
+ * memory from SO_MEMINFO, which, unlike SIOCINQ (only the next datagram
+ * for UDP), covers the whole queue, in the units SO_RCVBUF limits. */
+#define RXQ_SAMPLE_MS 10
+__thread uint32_t kernel_drops;
+__thread uint32_t rxq_bytes_max;
+__thread uint32_t interval_rxq_bytes_max;
+__thread uint32_t rcvbuf_bytes;  /* Actual limit; the kernel caps the request. */
+
+void rxq_sample(int sock)
+{
+  uint32_t meminfo[SK_MEMINFO_VARS];
+  socklen_t len = sizeof(meminfo);
+
+  CPRT_EOK0(getsockopt(sock, SOL_SOCKET, SO_MEMINFO, meminfo, &len));
+  if (meminfo[SK_MEMINFO_RMEM_ALLOC] > interval_rxq_bytes_max) {
+    interval_rxq_bytes_max = meminfo[SK_MEMINFO_RMEM_ALLOC];
+  }
+  if (meminfo[SK_MEMINFO_RMEM_ALLOC] > rxq_bytes_max) {
+    rxq_bytes_max = meminfo[SK_MEMINFO_RMEM_ALLOC];
+  }
+  rcvbuf_bytes = meminfo[SK_MEMINFO_RCVBUF];
+}  /* rxq_sample */
+
+/* Process the control messages of a received datagram (-K, -D). Returns
+ * the SO_TIMESTAMPNS kernel RX timestamp, or NULL. */
+struct timespec *cmsgs_input(struct msghdr *msg)
+{
+  struct cmsghdr *cmsg;
+  struct timespec *krx_ts = NULL;
+
+  for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+    if (cmsg->cmsg_level != SOL_SOCKET) {
+      continue;
+    }
+    if (cmsg->cmsg_type == SCM_TIMESTAMPNS) {
+      krx_ts = (struct timespec *)CMSG_DATA(cmsg);
+    }
+    else if (cmsg->cmsg_type == SO_RXQ_OVFL) {
+      memcpy(&kernel_drops, CMSG_DATA(cmsg), sizeof(kernel_drops));
+    }
+  }
+  return krx_ts;
+}  /* cmsgs_input */
+
+
+/* Each source (sender's address and port) has its own sequence of message
+ * numbers, so gaps are tracked per source. A socket can get several
+ * publishers' flows (e.g. with -N, or several publishers to a group).
+ * A bitmap window records which of the source's last SRC_WINDOW message
+ * numbers were skipped by a gap and are still missing, so that only a
+ * message that fills a gap reduces the loss count. Anything else below
+ * the expected number (a duplicate, one too late for the window, or a
+ * restarted publisher on the same address and port) is a duplicate. */
+#define MAX_SRCS 256
+#define SRC_WINDOW 1024  /* Bits; how late a message can fill its gap. */
+#define SRC_WORDS (SRC_WINDOW / 64)
+struct src_seq_s {
+  struct sockaddr_in addr;
+  uint64_t expected_msg_num;
+  uint64_t missing[SRC_WORDS];  /* By msg_num, below expected_msg_num. */
+};
+__thread struct src_seq_s src_seqs[MAX_SRCS];
+__thread int num_srcs;
+__thread int last_src;  /* Index of the previous message's source. */
+__thread uint64_t num_untracked_msgs;  /* Sources beyond MAX_SRCS; no gap checks. */
+
+/* Returns the source's entry (adding it, expecting msg_num, if new), or
+ * NULL if the table is full. */
+struct src_seq_s *src_seq_find(struct sockaddr_in *from, uint64_t msg_num)
+{
+  struct src_seq_s *src = &src_seqs[last_src];
+  int i;
+
+  if (num_srcs > 0 && src->addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+      src->addr.sin_port == from->sin_port) {
+    return src;
+  }
+  for (i = 0; i < num_srcs; i++) {
+    src = &src_seqs[i];
+    if (src->addr.sin_addr.s_addr == from->sin_addr.s_addr &&
+        src->addr.sin_port == from->sin_port) {
+      last_src = i;
+      return src;
+    }
+  }
+  if (num_srcs == MAX_SRCS) {
+    return NULL;
+  }
+  src = &src_seqs[num_srcs];
+  src->addr = *from;
+  src->expected_msg_num = msg_num;
+  memset(src->missing, 0, sizeof(src->missing));
+  last_src = num_srcs;
+  num_srcs++;
+  return src;
+}  /* src_seq_find */
+
+
+/* Process one received datagram. Returns 1 for the end-of-stream marker
+ * (except with -N, where a thread can get several publishers' flows, and
+ * exits on the idle timeout). The krx_ts is the kernel RX timestamp (-K),
+ * or NULL. */
+int msg_input(char *buf, ssize_t count, struct sockaddr_in *from,
+    struct timespec *rcv_ts, struct timespec *krx_ts)
+{
+  perf_msg_t *perf_msg = (perf_msg_t *)buf;
+  struct src_seq_s *src;
+
+  if (count < (ssize_t)sizeof(perf_msg_t)) {
+    num_short_msgs++;
+    return 0;
+  }
+  if ((perf_msg->flags & FLAGS_EOS) == FLAGS_EOS) {
+    return (num_threads == 1);
+  }
+
+  if (num_rcv_msgs == 0) {
+    first_rcv_ts = *rcv_ts;
+  }
+  last_rcv_ts = *rcv_ts;
+  num_rcv_msgs++;
+
+  src = src_seq_find(from, perf_msg->msg_num);
+  if (src == NULL) {
+    num_untracked_msgs++;
+  }
+  else {
+    uint64_t msg_num = perf_msg->msg_num;
+    uint64_t *word = &src->missing[(msg_num / 64) % SRC_WORDS];
+    uint64_t bit = 1ull << (msg_num % 64);
+
+    if (msg_num >= src->expected_msg_num) {
+      if (msg_num > src->expected_msg_num) {
+        uint64_t n = src->expected_msg_num;
+        num_gaps++;
+        num_lost_msgs += msg_num - n;
+        if (msg_num - n > SRC_WINDOW) {
+          n = msg_num - SRC_WINDOW;  /* Older ones can't be filled. */
+        }
+        for (; n < msg_num; n++) {
+          src->missing[(n / 64) % SRC_WORDS] |= 1ull << (n % 64);
+        }
+      }
+      *word &= ~bit;  /* Its slot may hold a missing bit from a window ago. */
+      src->expected_msg_num = msg_num + 1;
+    }
+    else if (src->expected_msg_num - msg_num <= SRC_WINDOW && (*word & bit) != 0) {
+      /* A late message was counted as lost when its gap was detected. */
+      *word &= ~bit;
+      num_ooo_msgs++;
+      num_lost_msgs--;
+    }
+    else {
+      num_dup_msgs++;
+    }
+  }
+
+  if ((perf_msg->flags & FLAGS_TIMESTAMP) == FLAGS_TIMESTAMP) {
+    uint64_t latency;
+    CPRT_DIFF_TS(latency, (*rcv_ts), perf_msg->send_ts);
+    /* The unsigned difference wraps if the clocks aren't comparable. */
+    if ((int64_t)latency <= 0) {
+      num_neg_latencies++;
+    }
+    else {
+      if (latency < min_latency) min_latency = latency;
+      if (latency > max_latency) max_latency = latency;
+      if (latency > interval_max_latency) interval_max_latency = latency;
+      sum_latencies += latency;
+      num_timestamps++;
+      if (hist_buckets != NULL) {
+        hist_input(latency);
+      }
+    }
+  }
+
+  if (o_kernel_ts && (perf_msg->flags & FLAGS_KERNEL_TS) == FLAGS_KERNEL_TS &&
+      count >= (ssize_t)(sizeof(perf_msg_t) + sizeof(perf_kernel_ts_t))) {
+    kts_msg_input(perf_msg, rcv_ts, krx_ts);
+  }
+
+  return 0;
+}  /* msg_input */
+
+
+/* Interval statistics (-I), printed by the receive loop. With -N, each
+ * thread prints its own lines, with its index. */
+void stats_print(int thread_index, uint64_t interval_ns)
+{
+  static __thread uint64_t prev_rcv_msgs = 0;
+  static __thread uint64_t prev_lost_msgs = 0;
+  static __thread uint64_t prev_timestamps = 0;
+  static __thread uint64_t prev_sum_latencies = 0;
+  static __thread uint32_t prev_kernel_drops = 0;
+
+  uint64_t interval_msgs = num_rcv_msgs - prev_rcv_msgs;
+  uint64_t interval_timestamps = num_timestamps - prev_timestamps;
+
+  flockfile(stdout);
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  printf("stats, ms_time=%"PRIu64", ", cprt_get_ms_time());
+  if (num_threads > 1) {
+    printf("thread=%d, ", thread_index);
+  }
+  printf("rcv_msgs=%"PRIu64", rcv_rate=%f, lost_msgs=%"PRIu64", latency_ns_avg=%"PRIu64", latency_ns_max=%"PRIu64", ",
+      interval_msgs,
+      (double)interval_msgs * 1000000000.0 / (double)interval_ns,
+      num_lost_msgs - prev_lost_msgs,
+      (interval_timestamps == 0) ? 0 : (sum_latencies - prev_sum_latencies) / interval_timestamps,
+      interval_max_latency);
+  if (o_drops) {
+    printf("kernel_drops=%u, rxq_bytes_max=%u, ",
+        kernel_drops - prev_kernel_drops, interval_rxq_bytes_max);
+    prev_kernel_drops = kernel_drops;
+    interval_rxq_bytes_max = 0;
+  }
+  printf("\n");
+  fflush(stdout);
+  funlockfile(stdout);
+
+  prev_rcv_msgs = num_rcv_msgs;
+  prev_lost_msgs = num_lost_msgs;
+  prev_timestamps = num_timestamps;
+  prev_sum_latencies = sum_latencies;
+  interval_max_latency = 0;
+}  /* stats_print */
+
+
+/* recvmmsg engine. Datagrams are received into an array of cache-aligned
+ * buffers, rcv_batch at a time, until the socket is empty (EAGAIN). All
+ * datagrams of a batch get the same receive timestamp. */
+#define CACHE_LINE_SIZE 64
+#define MAX_DGRAM_SIZE 8192  /* Multiple of CACHE_LINE_SIZE. */
+__thread char *mmsg_bufs;
+__thread struct mmsghdr *mmsgs;
+__thread struct iovec *mmsg_iovs;
+__thread struct sockaddr_in *mmsg_names;
+__thread char *mmsg_controls;  /* For -K. */
+#define MMSG_CONTROL_SIZE (CMSG_SPACE(sizeof(struct timespec)) + CMSG_SPACE(sizeof(uint32_t)))
+__thread uint64_t *batch_counts;  /* Number of recvmmsg() calls for each batch size. */
+
+void recvmmsg_create()
+{
+  int i;
+
+  ASSRT(posix_memalign((void **)&mmsg_bufs, CACHE_LINE_SIZE,
+      (size_t)rcv_batch * MAX_DGRAM_SIZE) == 0);
+  mmsgs = (struct mmsghdr *)calloc(rcv_batch, sizeof(struct mmsghdr));
+  ASSRT(mmsgs != NULL);
+  mmsg_iovs = (struct iovec *)calloc(rcv_batch, sizeof(struct iovec));
+  ASSRT(mmsg_iovs != NULL);
+  mmsg_names = (struct sockaddr_in *)calloc(rcv_batch, sizeof(struct sockaddr_in));
+  ASSRT(mmsg_names != NULL);
+  batch_counts = (uint64_t *)calloc(rcv_batch + 1, sizeof(uint64_t));
+  ASSRT(batch_counts != NULL);
+  mmsg_controls = (char *)calloc(rcv_batch, MMSG_CONTROL_SIZE);
+  ASSRT(mmsg_controls != NULL);
+
+  for (i = 0; i < rcv_batch; i++) {
+    mmsg_iovs[i].iov_base = &mmsg_bufs[i * MAX_DGRAM_SIZE];
+    mmsg_iovs[i].iov_len = MAX_DGRAM_SIZE;
+    mmsgs[i].msg_hdr.msg_iov = &mmsg_iovs[i];
+    mmsgs[i].msg_hdr.msg_iovlen = 1;
+    mmsgs[i].msg_hdr.msg_name = &mmsg_names[i];
+  }
+}  /* recvmmsg_create */
+
+/* Returns 1 if the end-of-stream marker was received. */
+int recvmmsg_drain(int sock)
+{
+  struct timespec rcv_ts;
+  int eos = 0;
+  int n, i;
+
+  while (! eos) {
+    for (i = 0; i < rcv_batch; i++) {
+      mmsgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_in);
+      if (o_kernel_ts || o_drops) {
+        mmsgs[i].msg_hdr.msg_control = &mmsg_controls[i * MMSG_CONTROL_SIZE];
+        mmsgs[i].msg_hdr.msg_controllen = MMSG_CONTROL_SIZE;
+      }
+    }
+    n = recvmmsg(sock, mmsgs, rcv_batch, MSG_DONTWAIT, NULL);
+    num_syscalls++;
+    if (n == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        batch_counts[0]++;  /* Socket drained. */
+      }
+      else {
+        perror("recvmmsg");
+      }
+      break;
+    }
+    RCV_GETTIME(&rcv_ts);
+    batch_counts[n]++;
+
+    for (i = 0; i < n; i++) {
+      struct timespec *krx_ts = (o_kernel_ts || o_drops) ? cmsgs_input(&mmsgs[i].msg_hdr) : NULL;
+      if (msg_input(mmsg_iovs[i].iov_base, mmsgs[i].msg_len, &mmsg_names[i], &rcv_ts, krx_ts)) {
+        eos = 1;
+      }
+    }
+  }
+
+  return eos;
+}  /* recvmmsg_drain */
+
+/* UDP GRO engine. The kernel coalesces consecutive datagrams of a flow
+ * into one super-datagram, and reports the original datagram size in a
+ * UDP_GRO control message. */
+#define GRO_BUF_SIZE 65536
+__thread char *gro_buf;
+__thread char gro_cmsg_buf[CMSG_SPACE(sizeof(int)) + CMSG_SPACE(sizeof(uint32_t))];
+__thread struct msghdr gro_hdr;
+__thread struct iovec gro_iov;
+__thread struct sockaddr_in gro_name;  /* All segments are from the same flow. */
+
+void gro_create()
+{
+  ASSRT(posix_memalign((void **)&gro_buf, CACHE_LINE_SIZE, GRO_BUF_SIZE) == 0);
+  batch_counts = (uint64_t *)calloc(rcv_batch + 1, sizeof(uint64_t));
+  ASSRT(batch_counts != NULL);
+
+  gro_iov.iov_base = gro_buf;
+  gro_iov.iov_len = GRO_BUF_SIZE;
+  gro_hdr.msg_iov = &gro_iov;
+  gro_hdr.msg_iovlen = 1;
+}  /* gro_create */
+
+/* Returns 1 if the end-of-stream marker was received. */
+int gro_drain(int sock)
+{
+  struct timespec rcv_ts;
+  struct cmsghdr *cmsg;
+  ssize_t count;
+  int eos = 0;
+
+  while (! eos) {
+    gro_hdr.msg_name = &gro_name;
+    gro_hdr.msg_namelen = sizeof(gro_name);
+    gro_hdr.msg_control = gro_cmsg_buf;
+    gro_hdr.msg_controllen = sizeof(gro_cmsg_buf);
+    count = recvmsg(sock, &gro_hdr, MSG_DONTWAIT);
+    num_syscalls++;
+    if (count == -1) {
+      if (errno == EAGAIN || errno == EWOULDBLOCK) {
+        batch_counts[0]++;  /* Socket drained. */
+      }
+      else {
+        perror("recvmsg");
+      }
+      break;
+    }
+    RCV_GETTIME(&rcv_ts);
+
+    /* No control message means the datagram was not coalesced. */
+    int seg_size = (int)count;
+    for (cmsg = CMSG_FIRSTHDR(&gro_hdr); cmsg != NULL;
+        cmsg = CMSG_NXTHDR(&gro_hdr, cmsg)) {
+      if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+        memcpy(&seg_size, CMSG_DATA(cmsg), sizeof(seg_size));
+      }
+    }
+    if (o_drops) {
+      cmsgs_input(&gro_hdr);
+    }
+
+    /* Split into the original datagrams; the last may be shorter. */
+    ssize_t offset;
+    int num_segs = 0;
+    for (offset = 0; offset < count; offset += seg_size) {
+      ssize_t seg_len = count - offset;
+      if (seg_len > seg_size) {
+        seg_len = seg_size;
+      }
+      if (msg_input(&gro_buf[offset], seg_len, &gro_name, &rcv_ts, NULL)) {
+        eos = 1;
+      }
+      num_segs++;
+    }
+    batch_counts[(num_segs > rcv_batch) ? rcv_batch : num_segs]++;
+  }
+
+  return eos;
+}  /* gro_drain */
+
+
+/* io_uring engine. A single multishot recvmsg request produces one
+ * completion per datagram, each in a buffer picked by the kernel from the
+ * provided buffer ring (rcv_batch buffers). The ring replaces epoll; the
+ * batch counts are completions per io_uring_enter(). */
+#define URING_BGID 0  /* Provided buffer group ID. */
+__thread sock_uring_t uring;
+__thread struct io_uring_buf_ring *uring_br;
+__thread char *uring_bufs;
+/* A name but no control, so the buffer holds the header, the sender's
+ * address, and the payload. */
+__thread struct msghdr uring_msghdr;
+__thread uint64_t num_uring_nobufs;  /* Times the buffer ring ran dry. */
+
+void uring_arm()
+{
+  struct io_uring_sqe *sqe = sock_uring_get_sqe(&uring);
+  ASSRT(sqe != NULL);
+  sqe->opcode = IORING_OP_RECVMSG;
+  sqe->flags = IOSQE_FIXED_FILE | IOSQE_BUFFER_SELECT;
+  sqe->ioprio = IORING_RECV_MULTISHOT;
+  sqe->fd = 0;
+  sqe->addr = (uint64_t)(uintptr_t)&uring_msghdr;
+  sqe->len = 1;
+  sqe->buf_group = URING_BGID;
+}  /* uring_arm */
+
+void uring_create(int sock)
+{
+  int i;
+
+  CPRT_EM1(sock_uring_init(&uring, 64, 0));
+  CPRT_EM1(sock_uring_register_files(&uring, &sock, 1));
+  CPRT_ENULL(uring_br = sock_uring_buf_ring_create(&uring, rcv_batch, URING_BGID));
+  ASSRT(posix_memalign((void **)&uring_bufs, CACHE_LINE_SIZE,
+      (size_t)rcv_batch * MAX_DGRAM_SIZE) == 0);
+  for (i = 0; i < rcv_batch; i++) {
+    sock_uring_buf_ring_add(uring_br, rcv_batch, &uring_bufs[i * MAX_DGRAM_SIZE],
+        MAX_DGRAM_SIZE, i);
+  }
+  batch_counts = (uint64_t *)calloc(rcv_batch + 1, sizeof(uint64_t));
+  ASSRT(batch_counts != NULL);
+  uring_msghdr.msg_namelen = sizeof(struct sockaddr_in);
+
+  uring_arm();
+}  /* uring_create */
+
+/* Wait up to wait_ms (-1 = forever) for datagrams and process them.
+ * Returns 1 if the end-of-stream marker was received. */
+int uring_rcv(int wait_ms)
+{
+  struct timespec rcv_ts;
+  struct io_uring_cqe *cqe;
+  uint64_t prev_enters = uring.num_enters;
+  int num_cqes = 0;
+  int rearm = 0;
+  int eos = 0;
+
+  CPRT_EM1(sock_uring_submit_and_wait(&uring, 1, wait_ms));
+  num_syscalls += uring.num_enters - prev_enters;
+  RCV_GETTIME(&rcv_ts);
+
+  while ((cqe = sock_uring_peek_cqe(&uring)) != NULL) {
+    if (cqe->res < 0) {
+      if (cqe->res != -ENOBUFS) {
+        fprintf(stderr, "ERROR: io_uring recvmsg: %s\n", strerror(-cqe->res));
+        exit(1);
+      }
+      num_uring_nobufs++;
+    }
+    else {
+      int bid = cqe->flags >> IORING_CQE_BUFFER_SHIFT;
+      char *buf = &uring_bufs[bid * MAX_DGRAM_SIZE];
+      struct io_uring_recvmsg_out *out = (struct io_uring_recvmsg_out *)buf;
+      struct sockaddr_in *name = (struct sockaddr_in *)(buf + sizeof(*out));
+      if (msg_input((char *)name + uring_msghdr.msg_namelen, out->payloadlen, name,
+          &rcv_ts, NULL)) {
+        eos = 1;
+      }
+      sock_uring_buf_ring_add(uring_br, rcv_batch, buf, MAX_DGRAM_SIZE, bid);
+      num_cqes++;
+    }
+    /* The kernel ends a multishot request on error or lack of buffers. */
+    if (! (cqe->flags & IORING_CQE_F_MORE)) {
+      rearm = 1;
+    }
+    sock_uring_cqe_seen(&uring);
+  }
+  batch_counts[(num_cqes > rcv_batch) ? rcv_batch : num_cqes]++;
+
+  if (rearm) {
+    uring_arm();  /* Submitted by the next call. */
+  }
+
+  return eos;
+}  /* uring_rcv */
+
+
+/* For the recvmmsg, gro, and uring engines. */
+void batch_print()
+{
+  uint64_t num_batches = 0;
+  uint64_t num_dgrams = 0;
+  int i;
+
+  /* Batch size histogram: calls that returned 1, 2, ... datagrams. */
+  for (i = 1; i <= rcv_batch; i++) {
+    printf("%"PRIu64"\n", batch_counts[i]);
+    num_batches += batch_counts[i];
+    num_dgrams += batch_counts[i] * i;
+  }
+  printf("rcv_batch=%d, batches=%"PRIu64", drained_calls=%"PRIu64", average_batch=%f, \n",
+      rcv_batch, num_batches, batch_counts[0],
+      (num_batches == 0) ? 0.0 : (double)num_dgrams / (double)num_batches);
+}  /* batch_print */
+
+
+uint64_t rusage_cpu_ns(struct rusage *ru)
+{
+  return (uint64_t)(ru->ru_utime.tv_sec + ru->ru_stime.tv_sec) * 1000000000
+      + (uint64_t)(ru->ru_utime.tv_usec + ru->ru_stime.tv_usec) * 1000;
+}  /* rusage_cpu_ns */
+
+
+/* Steer datagrams among the SO_REUSEPORT group's sockets (-N). The CBPF
+ * program returns the index of the socket to use, in bind order (which is
+ * thread order). */
+void reuseport_steer(int sock)
+{
+  struct sock_filter code[] = {
+    /* A = the CPU processing the datagram, or the skb's flow hash. */
+    { BPF_LD | BPF_W | BPF_ABS, 0, 0,
+      SKF_AD_OFF + ((rcv_steer == STEER_CPU) ? SKF_AD_CPU : SKF_AD_RXHASH) },
+    { BPF_ALU | BPF_MOD | BPF_K, 0, 0, (uint32_t)num_threads },
+    { BPF_RET | BPF_A, 0, 0, 0 }
+  };
+  struct sock_fprog prog;
+
+  prog.len = sizeof(code) / sizeof(code[0]);
+  prog.filter = code;
+  CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF,
+      (char*)&prog, sizeof(prog)));
+}  /* reuseport_steer */
+
+
+/* The index is the receive thread's (-N). */
+void init_sock(int sock, int index)
 {
   int opt_enable = 1;
   int flags;
@@ -221,6 +1031,17 @@ void init_sock(int sock)
   CPRT_EOK0(setsockopt(sock, SOL_SOCKET, SO_REUSEADDR,
       (char*)&opt_enable, sizeof(opt_enable)));
 
+  /* The threads' sockets share the port. For unicast, the kernel gives each
+   * datagram to one of them; for multicast, each gets a copy. */
+  if (num_threads > 1) {
+    CPRT_EOK0(setsockopt(sock, SOL_SOCKET, SO_REUSEPORT,
+        (char*)&opt_enable, sizeof(opt_enable)));
+    /* Attaching to the first socket, before bind, creates the group. */
+    if (index == 0 && rcv_steer != STEER_NONE) {
+      reuseport_steer(sock);
+    }
+  }
+
   /* Bind to port 12000. */
   memset(&dest_sin, 0, sizeof(dest_sin));
   dest_sin.sin_family = AF_INET;
@@ -229,11 +1050,13 @@ void init_sock(int sock)
   CPRT_EM1(bind(sock, &dest_sin, sizeof(dest_sin)));
 
   /* Join multicast group. */
-  memset(&add_member, 0, sizeof(add_member));
-  add_member.imr_multiaddr.s_addr = group_in.s_addr;
-  add_member.imr_interface.s_addr = iface_in.s_addr;
-  CPRT_EM1(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
-      (char*)&add_member, sizeof(add_member)));
+  if (group_is_mcast) {
+    memset(&add_member, 0, sizeof(add_member));
+    add_member.imr_multiaddr.s_addr = group_in.s_addr;
+    add_member.imr_interface.s_addr = iface_in.s_addr;
+    CPRT_EM1(setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP,
+        (char*)&add_member, sizeof(add_member)));
+  }
 
   /* Set non-blocking. */
   CPRT_EM1(flags = fcntl(sock, F_GETFL, 0));
@@ -243,22 +1066,434 @@ void init_sock(int sock)
   /* 128 MB socket buffer */
   CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_RCVBUF,
       (char*)&rcvbuf32, sizeof(rcvbuf32)));
+
+  /* Per-datagram socket drop count, in a control message. */
+  if (o_drops) {
+    CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_RXQ_OVFL,
+        (char*)&opt_enable, sizeof(opt_enable)));
+  }
+
+  /* Kernel software RX timestamps (CLOCK_REALTIME), in a control message. */
+  if (o_kernel_ts) {
+    CPRT_EM1(setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPNS,
+        (char*)&opt_enable, sizeof(opt_enable)));
+  }
+
+  /* Fall back to recvmmsg if the kernel doesn't have UDP GRO. */
+  if (rcv_engine == ENGINE_GRO) {
+    if (setsockopt(sock, SOL_UDP, UDP_GRO, &opt_enable, sizeof(opt_enable)) != 0) {
+      fprintf(stderr, "WARNING: UDP_GRO not supported (%s), using recvmmsg\n",
+          strerror(errno));
+      rcv_engine = ENGINE_RECVMMSG;
+      rcv_batch = 100;
+    }
+  }
 }  /* init_sock */
 
 
-int main(int argc, char **argv)
-{
+/* Receive threads (-N). Each thread has its own socket and epoll instance
+ * (or io_uring), and runs the receive loop with its own thread-local
+ * receive state. Without -N, the main thread runs the loop on thread 0.
+ * Since thread-local storage goes away with the thread, a thread copies
+ * its results here before exiting, and the main thread merges them. */
+struct rcv_thread_s {
+  int index;
+  int cpu;
   int sock;
-  int epoll_fd;
-  uint64_t cpuset;
+  CPRT_THREAD_T thread_id;
+  /* Results. */
+  const char *exit_reason;
+  uint64_t cpu_ns;
+  uint64_t rcv_msgs;
+  uint64_t short_msgs;
+  uint64_t gaps;
+  uint64_t lost_msgs;
+  uint64_t ooo_msgs;
+  uint64_t dup_msgs;
+  int srcs;
+  uint64_t untracked_msgs;
+  uint64_t timestamps;
+  uint64_t neg_latencies;
+  uint64_t min_latency;
+  uint64_t max_latency;
+  uint64_t sum_latencies;
+  uint64_t syscalls;
+  struct timespec first_rcv_ts;
+  struct timespec last_rcv_ts;
+  int *hist_buckets;
+  uint64_t hist_min_sample;
+  uint64_t hist_max_sample;
+  uint64_t hist_overflows;
+  uint64_t hist_num_samples;
+  uint64_t hist_sample_sum;
+  uint64_t *batch_counts;
+  struct kts_hist_s kts_hists[KTS_NUM_SEGS];
+  uint64_t krx_missing;
+  uint32_t kernel_drops;
+  uint32_t rxq_bytes_max;
+  uint32_t rcvbuf_bytes;
+  uint64_t uring_nobufs;
+};
+typedef struct rcv_thread_s rcv_thread_t;
+
+rcv_thread_t *rcv_threads;
+
+
+void rcv_loop(rcv_thread_t *thr)
+{
+  int sock = thr->sock;
+  int epoll_fd = -1;  /* Not with ENGINE_URING. */
   struct epoll_event event;
   struct epoll_event rtn_events[MAXEVENTS];
-  struct sockaddr from;
+  struct sockaddr_in from;
   socklen_t addrlen;
+  struct msghdr rcv_hdr;  /* For -K. */
+  struct iovec rcv_iov;
+  char rcv_control[MMSG_CONTROL_SIZE];
 #ifdef PRTOUT
   int s;
 #endif
 
+  if (o_kernel_ts) {
+    kts_create();
+  }
+  memset(&rcv_hdr, 0, sizeof(rcv_hdr));
+  if (rcv_engine == ENGINE_RECVMMSG) {
+    recvmmsg_create();
+  }
+  else if (rcv_engine == ENGINE_GRO) {
+    gro_create();
+  }
+  else if (rcv_engine == ENGINE_URING) {
+    uring_create(sock);
+  }
+
+  /* Create the epoll FD (the io_uring engine waits on its ring instead). */
+  if (rcv_engine != ENGINE_URING) {
+    CPRT_EM1(epoll_fd = epoll_create(1024));
+    event.events = EPOLLIN;
+    event.data.fd = sock;
+    CPRT_EM1(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event));
+  }
+
+  /* Wake up periodically for interval statistics and the idle timeout. */
+  int wait_ms = (o_stats_ms > 0 || o_idle_ms > 0) ? 100 : -1;
+  const char *exit_reason = NULL;
+  struct timespec cur_ts;
+  struct timespec stats_ts;
+  struct timespec rxq_ts;
+  struct timespec idle_ts;
+  RCV_GETTIME(&stats_ts);
+  rxq_ts = stats_ts;
+  memset(&idle_ts, 0, sizeof(idle_ts));
+  struct rusage start_rusage;
+  struct rusage end_rusage;
+  CPRT_EOK0(getrusage(RUSAGE_THREAD, &start_rusage));
+
+  while (exit_reason == NULL) {
+    int n, i;
+    ssize_t count;
+    char buf[8192];
+
+    if (rcv_engine == ENGINE_URING) {
+      if (uring_rcv(wait_ms)) {
+        exit_reason = "eos";
+      }
+    }
+    else {
+      n = epoll_wait(epoll_fd, rtn_events, MAXEVENTS, wait_ms);
+      num_syscalls++;
+
+      /* Sample the queue before it is drained. */
+      if (o_drops && n > 0) {
+        uint64_t rxq_ns;
+        RCV_GETTIME(&cur_ts);
+        CPRT_DIFF_TS(rxq_ns, cur_ts, rxq_ts);
+        if (rxq_ns >= RXQ_SAMPLE_MS * 1000000) {
+          rxq_sample(sock);
+          rxq_ts = cur_ts;
+        }
+      }
+
+      for (i = 0; i < n; i++) {
+        if ((rtn_events[i].events & EPOLLERR) ||
+            (rtn_events[i].events & EPOLLHUP) ||
+            (!(rtn_events[i].events & EPOLLIN))) {
+          /* An error has occured on this fd, or the socket is not
+             ready for reading (why were we notified then?) */
+          fprintf (stderr, "epoll error\n");
+          close (rtn_events[i].data.fd);
+          continue;
+        }
+
+        if (rcv_engine == ENGINE_RECVMMSG) {
+          if (recvmmsg_drain(rtn_events[i].data.fd)) {
+            exit_reason = "eos";
+          }
+          continue;
+        }
+        if (rcv_engine == ENGINE_GRO) {
+          if (gro_drain(rtn_events[i].data.fd)) {
+            exit_reason = "eos";
+          }
+          continue;
+        }
+
+        struct timespec *krx_ts = NULL;
+        if (o_kernel_ts || o_drops) {
+          /* Need recvmsg() for the control messages. */
+          rcv_iov.iov_base = buf;
+          rcv_iov.iov_len = sizeof buf;
+          rcv_hdr.msg_name = &from;
+          rcv_hdr.msg_namelen = sizeof(from);
+          rcv_hdr.msg_iov = &rcv_iov;
+          rcv_hdr.msg_iovlen = 1;
+          rcv_hdr.msg_control = rcv_control;
+          rcv_hdr.msg_controllen = sizeof(rcv_control);
+          count = recvmsg(rtn_events[i].data.fd, &rcv_hdr, 0);
+          if (count != -1) {
+            krx_ts = cmsgs_input(&rcv_hdr);
+          }
+        }
+        else {
+          addrlen = sizeof(from);
+          count = recvfrom(rtn_events[i].data.fd, buf, sizeof buf, 0,
+              (struct sockaddr *)&from, &addrlen);
+        }
+        num_syscalls++;
+        if (count == -1) {
+          if (errno != EAGAIN) {
+            perror ("read");
+          }
+          continue;
+        }
+        RCV_GETTIME(&cur_ts);
+
+#ifdef PRTOUT
+        /* Write the buffer to standard output */
+        s = write (1, buf, count);
+        if (s == -1) {
+          perror ("write");
+          abort ();
+        }
+#endif
+
+        if (msg_input(buf, count, &from, &cur_ts, krx_ts)) {
+          exit_reason = "eos";
+        }
+      }
+    }
+
+    RCV_GETTIME(&cur_ts);
+    uint64_t ns;
+    if (o_stats_ms > 0) {
+      CPRT_DIFF_TS(ns, cur_ts, stats_ts);
+      if (ns >= (uint64_t)o_stats_ms * 1000000) {
+        stats_print(thr->index, ns);
+        stats_ts = cur_ts;
+      }
+    }
+    /* The idle timer starts with the first message. A thread that gets
+     * none (-N) starts it when any other thread gets one. */
+    if (num_rcv_msgs > 0) {
+      idle_ts = last_rcv_ts;
+      any_rcv_started = 1;
+    }
+    else if (idle_ts.tv_sec == 0 && any_rcv_started) {
+      idle_ts = cur_ts;
+    }
+    if (o_idle_ms > 0 && idle_ts.tv_sec != 0) {
+      CPRT_DIFF_TS(ns, cur_ts, idle_ts);
+      if (ns >= (uint64_t)o_idle_ms * 1000000) {
+        exit_reason = "idle";
+      }
+    }
+  }
+
+  CPRT_EOK0(getrusage(RUSAGE_THREAD, &end_rusage));
+  thr->cpu_ns = rusage_cpu_ns(&end_rusage) - rusage_cpu_ns(&start_rusage);
+  thr->exit_reason = exit_reason;
+
+  if (rcv_engine != ENGINE_URING) {
+    close (epoll_fd);
+  }
+  if (o_drops) {
+    rxq_sample(sock);
+  }
+  if (rcv_engine == ENGINE_URING) {
+    sock_uring_buf_ring_free(&uring, uring_br, rcv_batch, URING_BGID);
+    sock_uring_exit(&uring);
+    free(uring_bufs);
+  }
+}  /* rcv_loop */
+
+
+/* Copy the thread-local results (on the receive thread). */
+void rcv_results_save(rcv_thread_t *thr)
+{
+  thr->rcv_msgs = num_rcv_msgs;
+  thr->short_msgs = num_short_msgs;
+  thr->gaps = num_gaps;
+  thr->lost_msgs = num_lost_msgs;
+  thr->ooo_msgs = num_ooo_msgs;
+  thr->dup_msgs = num_dup_msgs;
+  thr->srcs = num_srcs;
+  thr->untracked_msgs = num_untracked_msgs;
+  thr->timestamps = num_timestamps;
+  thr->neg_latencies = num_neg_latencies;
+  thr->min_latency = min_latency;
+  thr->max_latency = max_latency;
+  thr->sum_latencies = sum_latencies;
+  thr->syscalls = num_syscalls;
+  thr->first_rcv_ts = first_rcv_ts;
+  thr->last_rcv_ts = last_rcv_ts;
+  thr->hist_buckets = hist_buckets;
+  thr->hist_min_sample = hist_min_sample;
+  thr->hist_max_sample = hist_max_sample;
+  thr->hist_overflows = hist_overflows;
+  thr->hist_num_samples = hist_num_samples;
+  thr->hist_sample_sum = hist_sample_sum;
+  thr->batch_counts = batch_counts;
+  memcpy(thr->kts_hists, kts_hists, sizeof(kts_hists));
+  thr->krx_missing = num_krx_missing;
+  thr->kernel_drops = kernel_drops;
+  thr->rxq_bytes_max = rxq_bytes_max;
+  thr->rcvbuf_bytes = rcvbuf_bytes;
+  thr->uring_nobufs = num_uring_nobufs;
+}  /* rcv_results_save */
+
+/* Returns 1 if ts1 is earlier than ts2. */
+int ts_lt(struct timespec *ts1, struct timespec *ts2)
+{
+  return (ts1->tv_sec < ts2->tv_sec) ||
+      (ts1->tv_sec == ts2->tv_sec && ts1->tv_nsec < ts2->tv_nsec);
+}  /* ts_lt */
+
+/* Add a thread's results to the main thread's receive state. */
+void rcv_results_merge(rcv_thread_t *thr)
+{
+  int seg, i;
+
+  if (thr->rcv_msgs > 0) {
+    if (num_rcv_msgs == 0 || ts_lt(&thr->first_rcv_ts, &first_rcv_ts)) {
+      first_rcv_ts = thr->first_rcv_ts;
+    }
+    if (num_rcv_msgs == 0 || ts_lt(&last_rcv_ts, &thr->last_rcv_ts)) {
+      last_rcv_ts = thr->last_rcv_ts;
+    }
+  }
+  num_rcv_msgs += thr->rcv_msgs;
+  num_short_msgs += thr->short_msgs;
+  num_gaps += thr->gaps;
+  num_lost_msgs += thr->lost_msgs;
+  num_ooo_msgs += thr->ooo_msgs;
+  num_dup_msgs += thr->dup_msgs;
+  num_untracked_msgs += thr->untracked_msgs;
+  num_timestamps += thr->timestamps;
+  num_neg_latencies += thr->neg_latencies;
+  if (thr->min_latency < min_latency) min_latency = thr->min_latency;
+  if (thr->max_latency > max_latency) max_latency = thr->max_latency;
+  sum_latencies += thr->sum_latencies;
+  num_syscalls += thr->syscalls;
+
+  if (hist_buckets != NULL) {
+    for (i = 0; i < hist_num_buckets; i++) {
+      hist_buckets[i] += thr->hist_buckets[i];
+    }
+    if (thr->hist_min_sample < hist_min_sample) hist_min_sample = thr->hist_min_sample;
+    if (thr->hist_max_sample > hist_max_sample) hist_max_sample = thr->hist_max_sample;
+    hist_overflows += thr->hist_overflows;
+    hist_num_samples += thr->hist_num_samples;
+    hist_sample_sum += thr->hist_sample_sum;
+  }
+
+  if (thr->batch_counts != NULL) {
+    if (batch_counts == NULL) {
+      batch_counts = (uint64_t *)calloc(rcv_batch + 1, sizeof(uint64_t));
+      ASSRT(batch_counts != NULL);
+    }
+    for (i = 0; i <= rcv_batch; i++) {
+      batch_counts[i] += thr->batch_counts[i];
+    }
+  }
+
+  if (o_kernel_ts) {
+    for (seg = 0; seg < KTS_NUM_SEGS; seg++) {
+      struct kts_hist_s *hist = &kts_hists[seg];
+      struct kts_hist_s *thr_hist = &thr->kts_hists[seg];
+      if (hist->buckets == NULL && thr_hist->buckets != NULL) {
+        hist->buckets = (int *)calloc(hist_num_buckets, sizeof(int));
+        ASSRT(hist->buckets != NULL);
+      }
+      if (thr_hist->buckets != NULL) {
+        for (i = 0; i < hist_num_buckets; i++) {
+          hist->buckets[i] += thr_hist->buckets[i];
+        }
+      }
+      if (hist->num_samples == 0 || thr_hist->min_sample < hist->min_sample) {
+        hist->min_sample = thr_hist->min_sample;
+      }
+      if (thr_hist->max_sample > hist->max_sample) hist->max_sample = thr_hist->max_sample;
+      hist->overflows += thr_hist->overflows;
+      hist->num_samples += thr_hist->num_samples;
+      hist->sample_sum += thr_hist->sample_sum;
+      hist->negatives += thr_hist->negatives;
+    }
+    num_krx_missing += thr->krx_missing;
+  }
+
+  kernel_drops += thr->kernel_drops;
+  if (thr->rxq_bytes_max > rxq_bytes_max) rxq_bytes_max = thr->rxq_bytes_max;
+  if (thr->rcvbuf_bytes > rcvbuf_bytes) rcvbuf_bytes = thr->rcvbuf_bytes;
+  num_uring_nobufs += thr->uring_nobufs;
+}  /* rcv_results_merge */
+
+void rcv_thread_print(rcv_thread_t *thr)
+{
+  uint64_t duration_ns;
+  CPRT_DIFF_TS(duration_ns, thr->last_rcv_ts, thr->first_rcv_ts);
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  printf("thread=%d, cpu=%d, exit_reason=%s, srcs=%d, rcv_msgs=%"PRIu64", lost_msgs=%"PRIu64", gaps=%"PRIu64", ooo_msgs=%"PRIu64", dup_msgs=%"PRIu64", syscalls=%"PRIu64", msgs_per_syscall=%f, cpu_ns_per_msg=%f, result_rate=%f, ",
+      thr->index, thr->cpu, thr->exit_reason, thr->srcs, thr->rcv_msgs,
+      thr->lost_msgs, thr->gaps, thr->ooo_msgs, thr->dup_msgs, thr->syscalls,
+      (thr->syscalls == 0) ? 0.0 : (double)thr->rcv_msgs / (double)thr->syscalls,
+      (thr->rcv_msgs == 0) ? 0.0 : (double)thr->cpu_ns / (double)thr->rcv_msgs,
+      (duration_ns == 0) ? 0.0 : (double)(thr->rcv_msgs - 1) * 1000000000.0 / (double)duration_ns);
+  if (o_drops) {
+    printf("kernel_drops=%u, rxq_bytes_max=%u, ", thr->kernel_drops, thr->rxq_bytes_max);
+  }
+  printf("\n");
+}  /* rcv_thread_print */
+
+CPRT_THREAD_ENTRYPOINT rcv_thread(void *in_arg)
+{
+  rcv_thread_t *thr = (rcv_thread_t *)in_arg;
+  uint64_t cpuset;
+
+  if (thr->cpu > -1) {
+    CPRT_CPU_ZERO(&cpuset);
+    CPRT_CPU_SET(thr->cpu, &cpuset);
+    cprt_set_affinity(cpuset);
+  }
+  if (hist_num_buckets > 0) {
+    hist_create();
+  }
+
+  rcv_loop(thr);
+  rcv_results_save(thr);
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* rcv_thread */
+
+
+int main(int argc, char **argv)
+{
+  uint64_t cpuset;
+  uint64_t cpu_ns = 0;
+  const char *exit_reason;
+  int i;
+
   CPRT_NET_START;
 
   CPRT_INITTIME();
@@ -271,8 +1506,8 @@ int main(int argc, char **argv)
   }
 
   /* Leave "comma space" at end of line to make parsing output easier. */
-  printf("o_affinity_cpu=%d, o_group=%s, o_histogram=%s, o_interface=%s, \n",
-         o_affinity_cpu, o_group, o_histogram, o_interface);
+  printf("o_affinity_cpu=%d, o_drops=%d, o_engine=%s, o_group=%s, o_histogram=%s, o_interface=%s, o_stats_ms=%d, o_kernel_ts=%d, o_threads=%s, o_idle_ms=%d, \n",
+         o_affinity_cpu, o_drops, o_engine, o_group, o_histogram, o_interface, o_stats_ms, o_kernel_ts, o_threads, o_idle_ms);
 
   /* Pin time-critical thread (sending thread) to requested CPU core. */
   if (o_affinity_cpu > -1) {
@@ -281,72 +1516,88 @@ int main(int argc, char **argv)
     cprt_set_affinity(cpuset);
   }
 
-  /* Create the socket for receiving. */
-  sock = socket(PF_INET,SOCK_DGRAM,0);
-  ASSRT(sock != -1);
-  init_sock(sock);
-
-  /* Create the epoll FD. */
-  CPRT_EM1(epoll_fd = epoll_create(1024));
-  event.events = EPOLLIN;
-  event.data.fd = sock;
-  CPRT_EM1(epoll_ctl(epoll_fd, EPOLL_CTL_ADD, sock, &event));
-
-  while (1) {
-    int n, i;
-    ssize_t count;
-    char buf[8192];
+  /* Create the sockets for receiving, in thread order (for -N steering). */
+  rcv_threads = (rcv_thread_t *)calloc(num_threads, sizeof(rcv_thread_t));
+  ASSRT(rcv_threads != NULL);
+  for (i = 0; i < num_threads; i++) {
+    rcv_thread_t *thr = &rcv_threads[i];
+    thr->index = i;
+    thr->cpu = (thread_first_cpu > -1) ? (thread_first_cpu + i) : -1;
+    thr->sock = socket(PF_INET,SOCK_DGRAM,0);
+    ASSRT(thr->sock != -1);
+    init_sock(thr->sock, i);
+  }
 
-    while (1) {
-      n = epoll_wait(epoll_fd, rtn_events, MAXEVENTS, -1);
-      if (n > 0) {
-        break;
-      }
+  if (num_threads == 1) {
+    /* The main thread is the receive thread. */
+    if (rcv_threads[0].cpu > -1) {
+      CPRT_CPU_ZERO(&cpuset);
+      CPRT_CPU_SET(rcv_threads[0].cpu, &cpuset);
+      cprt_set_affinity(cpuset);
     }
-
-    for (i = 0; i < n; i++) {
-      if ((rtn_events[i].events & EPOLLERR) ||
-          (rtn_events[i].events & EPOLLHUP) ||
-          (!(rtn_events[i].events & EPOLLIN))) {
-        /* An error has occured on this fd, or the socket is not
-           ready for reading (why were we notified then?) */
-        fprintf (stderr, "epoll error\n");
-        close (rtn_events[i].data.fd);
-        continue;
-      }
-
-      addrlen = sizeof(from);
-
-      count = recvfrom(rtn_events[i].data.fd, buf, sizeof buf, 0, &from, &addrlen);
-      if (count == -1) {
-        if (errno != EAGAIN) {
-          perror ("read");
-        }
-      }
-
-      if (count == 0) {
-        close (rtn_events[i].data.fd);
-        continue;
-      }
-
-#ifdef PRTOUT
-      /* Write the buffer to standard output */
-      s = write (1, buf, count);
-      if (s == -1) {
-        perror ("write");
-        abort ();
-      }
-#endif
+    rcv_loop(&rcv_threads[0]);
+    cpu_ns = rcv_threads[0].cpu_ns;
+    exit_reason = rcv_threads[0].exit_reason;
+  }
+  else {
+    for (i = 0; i < num_threads; i++) {
+      CPRT_THREAD_CREATE(rcv_threads[i].thread_id, rcv_thread, &rcv_threads[i]);
+    }
+    for (i = 0; i < num_threads; i++) {
+      rcv_thread_t *thr = &rcv_threads[i];
+      CPRT_THREAD_JOIN(thr->thread_id);
+      rcv_results_merge(thr);
+      cpu_ns += thr->cpu_ns;
+    }
+    exit_reason = "idle";
+    for (i = 0; i < num_threads; i++) {
+      rcv_thread_print(&rcv_threads[i]);
     }
   }
 
-  close (epoll_fd);
-
   /* Time to exit. */
   /* Done, print results. */
   if (hist_buckets != NULL) {
     hist_print();
   }
+  if (rcv_engine != ENGINE_RECVFROM) {
+    batch_print();
+  }
+  if (o_kernel_ts) {
+    kts_print();
+  }
+  if (o_drops) {
+    printf("kernel_drops=%u, rxq_bytes_max=%u, rcvbuf_bytes=%u, \n",
+        kernel_drops, rxq_bytes_max, rcvbuf_bytes);
+  }
+  if (rcv_engine == ENGINE_URING) {
+    printf("uring_nobufs=%"PRIu64", \n", num_uring_nobufs);
+  }
+  if (num_untracked_msgs > 0) {
+    printf("WARNING: more than %d sources, untracked_msgs=%"PRIu64" not checked for gaps, \n",
+        MAX_SRCS, num_untracked_msgs);
+  }
+
+  uint64_t duration_ns;
+  CPRT_DIFF_TS(duration_ns, last_rcv_ts, first_rcv_ts);
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  printf("exit_reason=%s, rcv_msgs=%"PRIu64", lost_msgs=%"PRIu64", gaps=%"PRIu64", ooo_msgs=%"PRIu64", dup_msgs=%"PRIu64", short_msgs=%"PRIu64", syscalls=%"PRIu64", msgs_per_syscall=%f, cpu_ns_per_msg=%f, duration_ns=%"PRIu64", result_rate=%f, ",
+      exit_reason, num_rcv_msgs, num_lost_msgs, num_gaps, num_ooo_msgs, num_dup_msgs,
+      num_short_msgs, num_syscalls,
+      (num_syscalls == 0) ? 0.0 : (double)num_rcv_msgs / (double)num_syscalls,
+      (num_rcv_msgs == 0) ? 0.0 : (double)cpu_ns / (double)num_rcv_msgs,
+      duration_ns,
+      /* Don't count initial message. */
+      (duration_ns == 0) ? 0.0 : (double)(num_rcv_msgs - 1) * 1000000000.0 / (double)duration_ns);
+  if (num_timestamps > 0 || num_neg_latencies > 0) {
+    printf("min_latency=%"PRIu64", max_latency=%"PRIu64", average latency=%"PRIu64", neg_latencies=%"PRIu64", \n",
+        (num_timestamps == 0) ? 0 : min_latency, max_latency,
+        (num_timestamps == 0) ? 0 : sum_latencies / num_timestamps,
+        num_neg_latencies);
+  }
+  else {
+    printf("\n");
+  }
 
   CPRT_NET_CLEANUP;
   return 0;
@@ -0,0 +1,295 @@
+/* sock_uring.c - minimal io_uring support for the sock_perf tools. */
+/*
+  Copyright (c) 2021-2022 Informatica Corporation
+  Permission is granted to licensees to use or alter this software for any
+  purpose, including commercial applications, according to the terms laid
+  out in the Software License Agreement.
+
+  This source code example is provided by Informatica for educational
+  and evaluation purposes only.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES 
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF 
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR 
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE 
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR 
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE 
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF 
+  THE LIKELIHOOD OF SUCH DAMAGES.
+*/
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "sock_uring.h"
+
+#define LOAD_ACQUIRE(p_) __atomic_load_n((p_), __ATOMIC_ACQUIRE)
+#define STORE_RELEASE(p_, v_) __atomic_store_n((p_), (v_), __ATOMIC_RELEASE)
+
+
+/* Undo a partly done sock_uring_init(), preserving errno. */
+void sock_uring_init_fail(sock_uring_t *ring)
+{
+  int save_errno = errno;
+
+  if (ring->sqes != NULL) {
+    munmap(ring->sqes, ring->sqes_sz);
+  }
+  if (ring->cq_ring_ptr != NULL) {
+    munmap(ring->cq_ring_ptr, ring->cq_ring_sz);
+  }
+  if (ring->sq_ring_ptr != NULL) {
+    munmap(ring->sq_ring_ptr, ring->sq_ring_sz);
+  }
+  close(ring->ring_fd);
+  ring->ring_fd = -1;
+  errno = save_errno;
+}  /* sock_uring_init_fail */
+
+
+int sock_uring_init(sock_uring_t *ring, unsigned entries, unsigned setup_flags)
+{
+  struct io_uring_params params;
+  char *sq_ptr;
+  char *cq_ptr;
+
+  memset(ring, 0, sizeof(*ring));
+  memset(&params, 0, sizeof(params));
+  params.flags = setup_flags;
+  if (setup_flags & IORING_SETUP_SQPOLL) {
+    params.sq_thread_idle = 1000;  /* ms before the kernel thread sleeps. */
+  }
+
+  ring->ring_fd = (int)syscall(__NR_io_uring_setup, entries, &params);
+  if (ring->ring_fd == -1) {
+    return -1;
+  }
+  ring->setup_flags = setup_flags;
+
+  ring->sq_ring_sz = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+  ring->cq_ring_sz = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    if (ring->cq_ring_sz > ring->sq_ring_sz) {
+      ring->sq_ring_sz = ring->cq_ring_sz;
+    }
+    ring->cq_ring_sz = ring->sq_ring_sz;
+  }
+
+  sq_ptr = mmap(NULL, ring->sq_ring_sz, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQ_RING);
+  if (sq_ptr == MAP_FAILED) {
+    sock_uring_init_fail(ring);
+    return -1;
+  }
+  ring->sq_ring_ptr = sq_ptr;
+
+  if (params.features & IORING_FEAT_SINGLE_MMAP) {
+    cq_ptr = sq_ptr;
+  }
+  else {
+    cq_ptr = mmap(NULL, ring->cq_ring_sz, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_CQ_RING);
+    if (cq_ptr == MAP_FAILED) {
+      sock_uring_init_fail(ring);
+      return -1;
+    }
+    ring->cq_ring_ptr = cq_ptr;
+  }
+
+  ring->sqes_sz = params.sq_entries * sizeof(struct io_uring_sqe);
+  ring->sqes = mmap(NULL, ring->sqes_sz, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, ring->ring_fd, IORING_OFF_SQES);
+  if (ring->sqes == MAP_FAILED) {
+    ring->sqes = NULL;
+    sock_uring_init_fail(ring);
+    return -1;
+  }
+
+  ring->sq_head = (unsigned *)(sq_ptr + params.sq_off.head);
+  ring->sq_tail = (unsigned *)(sq_ptr + params.sq_off.tail);
+  ring->sq_mask = (unsigned *)(sq_ptr + params.sq_off.ring_mask);
+  ring->sq_flags = (unsigned *)(sq_ptr + params.sq_off.flags);
+  ring->sq_array = (unsigned *)(sq_ptr + params.sq_off.array);
+  ring->sq_local_tail = *ring->sq_tail;
+
+  ring->cq_head = (unsigned *)(cq_ptr + params.cq_off.head);
+  ring->cq_tail = (unsigned *)(cq_ptr + params.cq_off.tail);
+  ring->cq_mask = (unsigned *)(cq_ptr + params.cq_off.ring_mask);
+  ring->cqes = (struct io_uring_cqe *)(cq_ptr + params.cq_off.cqes);
+
+  return 0;
+}  /* sock_uring_init */
+
+
+void sock_uring_exit(sock_uring_t *ring)
+{
+  munmap(ring->sqes, ring->sqes_sz);
+  munmap(ring->sq_ring_ptr, ring->sq_ring_sz);
+  if (ring->cq_ring_ptr != NULL) {
+    munmap(ring->cq_ring_ptr, ring->cq_ring_sz);
+  }
+  close(ring->ring_fd);
+}  /* sock_uring_exit */
+
+
+/* Returns a zeroed SQE, or NULL if the submission queue is full. */
+struct io_uring_sqe *sock_uring_get_sqe(sock_uring_t *ring)
+{
+  unsigned head = LOAD_ACQUIRE(ring->sq_head);
+  unsigned mask = *ring->sq_mask;
+  struct io_uring_sqe *sqe;
+
+  if (ring->sq_local_tail - head > mask) {
+    return NULL;
+  }
+  sqe = &ring->sqes[ring->sq_local_tail & mask];
+  memset(sqe, 0, sizeof(*sqe));
+  ring->sq_array[ring->sq_local_tail & mask] = ring->sq_local_tail & mask;
+  ring->sq_local_tail++;
+
+  return sqe;
+}  /* sock_uring_get_sqe */
+
+
+/* Submit the SQEs handed out since the last call, and wait until at least
+ * wait_nr completions are available (timeout_ms < 0 means no timeout).
+ * With SQPOLL, the kernel thread does the submitting, so a system call is
+ * only made to wake it up or to wait for completions that are not ready.
+ * Returns the number of completions available, 0 on timeout. */
+int sock_uring_submit_and_wait(sock_uring_t *ring, unsigned wait_nr, int timeout_ms)
+{
+  unsigned to_submit = ring->sq_local_tail - *ring->sq_tail;
+  unsigned enter_flags = 0;
+  int rtn;
+
+  STORE_RELEASE(ring->sq_tail, ring->sq_local_tail);
+
+  if (ring->setup_flags & IORING_SETUP_SQPOLL) {
+    /* The tail store must be visible before the flags are read, or a
+     * wakeup can be missed. */
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    if (to_submit > 0 && (LOAD_ACQUIRE(ring->sq_flags) & IORING_SQ_NEED_WAKEUP)) {
+      enter_flags |= IORING_ENTER_SQ_WAKEUP;
+    }
+    to_submit = 0;
+    if (LOAD_ACQUIRE(ring->cq_tail) - *ring->cq_head >= wait_nr) {
+      wait_nr = 0;  /* Already have them. */
+    }
+    if (enter_flags == 0 && wait_nr == 0) {
+      return LOAD_ACQUIRE(ring->cq_tail) - *ring->cq_head;
+    }
+  }
+
+  if (wait_nr > 0) {
+    enter_flags |= IORING_ENTER_GETEVENTS;
+  }
+
+  ring->num_enters++;
+  if (timeout_ms >= 0 && wait_nr > 0) {
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+
+    ts.tv_sec = timeout_ms / 1000;
+    ts.tv_nsec = (timeout_ms % 1000) * 1000000;
+    memset(&arg, 0, sizeof(arg));
+    arg.ts = (uint64_t)(uintptr_t)&ts;
+    rtn = (int)syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, wait_nr,
+        enter_flags | IORING_ENTER_EXT_ARG, &arg, sizeof(arg));
+  }
+  else {
+    rtn = (int)syscall(__NR_io_uring_enter, ring->ring_fd, to_submit, wait_nr,
+        enter_flags, NULL, 0);
+  }
+  if (rtn == -1 && errno != ETIME && errno != EINTR) {
+    return -1;
+  }
+
+  return LOAD_ACQUIRE(ring->cq_tail) - *ring->cq_head;
+}  /* sock_uring_submit_and_wait */
+
+
+/* Returns the next completion, or NULL if there are none. */
+struct io_uring_cqe *sock_uring_peek_cqe(sock_uring_t *ring)
+{
+  unsigned head = *ring->cq_head;
+
+  if (head == LOAD_ACQUIRE(ring->cq_tail)) {
+    return NULL;
+  }
+  return &ring->cqes[head & *ring->cq_mask];
+}  /* sock_uring_peek_cqe */
+
+
+void sock_uring_cqe_seen(sock_uring_t *ring)
+{
+  STORE_RELEASE(ring->cq_head, *ring->cq_head + 1);
+}  /* sock_uring_cqe_seen */
+
+
+int sock_uring_register_files(sock_uring_t *ring, int *fds, unsigned num_fds)
+{
+  return (int)syscall(__NR_io_uring_register, ring->ring_fd,
+      IORING_REGISTER_FILES, fds, num_fds);
+}  /* sock_uring_register_files */
+
+
+/* Create and register a provided buffer ring for buffer group bgid. The
+ * entries must be a power of 2. Returns NULL on failure. */
+struct io_uring_buf_ring *sock_uring_buf_ring_create(sock_uring_t *ring, unsigned entries, int bgid)
+{
+  struct io_uring_buf_reg reg;
+  struct io_uring_buf_ring *br;
+  size_t ring_sz = entries * sizeof(struct io_uring_buf);
+
+  br = mmap(NULL, ring_sz, PROT_READ | PROT_WRITE,
+      MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+  if (br == MAP_FAILED) {
+    return NULL;
+  }
+  br->tail = 0;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)br;
+  reg.ring_entries = entries;
+  reg.bgid = bgid;
+  if (syscall(__NR_io_uring_register, ring->ring_fd,
+      IORING_REGISTER_PBUF_RING, &reg, 1) == -1) {
+    munmap(br, ring_sz);
+    return NULL;
+  }
+
+  return br;
+}  /* sock_uring_buf_ring_create */
+
+
+/* Unregister and unmap a buffer ring from sock_uring_buf_ring_create(). */
+void sock_uring_buf_ring_free(sock_uring_t *ring, struct io_uring_buf_ring *br, unsigned entries, int bgid)
+{
+  struct io_uring_buf_reg reg;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.bgid = bgid;
+  syscall(__NR_io_uring_register, ring->ring_fd,
+      IORING_UNREGISTER_PBUF_RING, &reg, 1);
+  munmap(br, entries * sizeof(struct io_uring_buf));
+}  /* sock_uring_buf_ring_free */
+
+
+/* Give a buffer (back) to the kernel. */
+void sock_uring_buf_ring_add(struct io_uring_buf_ring *br, unsigned entries, void *addr, unsigned len, int bid)
+{
+  unsigned short tail = br->tail;
+  struct io_uring_buf *buf = &br->bufs[tail & (entries - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)addr;
+  buf->len = len;
+  buf->bid = (unsigned short)bid;
+  STORE_RELEASE(&br->tail, (unsigned short)(tail + 1));
+}  /* sock_uring_buf_ring_add */
@@ -0,0 +1,78 @@
+/* sock_uring.h - minimal io_uring support for the sock_perf tools. */
+/*
+  Copyright (c) 2021-2022 Informatica Corporation
+  Permission is granted to licensees to use or alter this software for any
+  purpose, including commercial applications, according to the terms laid
+  out in the Software License Agreement.
+
+  This source code example is provided by Informatica for educational
+  and evaluation purposes only.
+
+  THE SOFTWARE IS PROVIDED "AS IS" AND INFORMATICA DISCLAIMS ALL WARRANTIES 
+  EXPRESS OR IMPLIED, INCLUDING WITHOUT LIMITATION, ANY IMPLIED WARRANTIES OF 
+  NON-INFRINGEMENT, MERCHANTABILITY OR FITNESS FOR A PARTICULAR 
+  PURPOSE.  INFORMATICA DOES NOT WARRANT THAT USE OF THE SOFTWARE WILL BE 
+  UNINTERRUPTED OR ERROR-FREE.  INFORMATICA SHALL NOT, UNDER ANY CIRCUMSTANCES,
+  BE LIABLE TO LICENSEE FOR LOST PROFITS, CONSEQUENTIAL, INCIDENTAL, SPECIAL OR 
+  INDIRECT DAMAGES ARISING OUT OF OR RELATED TO THIS AGREEMENT OR THE 
+  TRANSACTIONS CONTEMPLATED HEREUNDER, EVEN IF INFORMATICA HAS BEEN APPRISED OF 
+  THE LIKELIHOOD OF SUCH DAMAGES.
+*/
+
+/* Just enough of io_uring for sock_perf_pub and sock_perf_sub, using the
+ * raw system calls so that liburing is not needed. Linux only. Functions
+ * return -1 and set errno on failure, for use with CPRT_EM1().
+ */
+
+#ifndef SOCK_URING_H
+#define SOCK_URING_H
+
+#include <inttypes.h>
+#include <linux/io_uring.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct sock_uring_s {
+  int ring_fd;
+  unsigned setup_flags;
+  /* Submission queue. */
+  unsigned *sq_head;
+  unsigned *sq_tail;
+  unsigned *sq_mask;
+  unsigned *sq_flags;
+  unsigned *sq_array;
+  unsigned sq_local_tail;  /* SQEs handed out but not yet submitted. */
+  struct io_uring_sqe *sqes;
+  /* Completion queue. */
+  unsigned *cq_head;
+  unsigned *cq_tail;
+  unsigned *cq_mask;
+  struct io_uring_cqe *cqes;
+  /* For cleanup. */
+  void *sq_ring_ptr;
+  size_t sq_ring_sz;
+  void *cq_ring_ptr;
+  size_t cq_ring_sz;
+  size_t sqes_sz;
+  uint64_t num_enters;  /* io_uring_enter() system calls. */
+};
+typedef struct sock_uring_s sock_uring_t;
+
+int sock_uring_init(sock_uring_t *ring, unsigned entries, unsigned setup_flags);
+void sock_uring_exit(sock_uring_t *ring);
+struct io_uring_sqe *sock_uring_get_sqe(sock_uring_t *ring);
+int sock_uring_submit_and_wait(sock_uring_t *ring, unsigned wait_nr, int timeout_ms);
+struct io_uring_cqe *sock_uring_peek_cqe(sock_uring_t *ring);
+void sock_uring_cqe_seen(sock_uring_t *ring);
+int sock_uring_register_files(sock_uring_t *ring, int *fds, unsigned num_fds);
+struct io_uring_buf_ring *sock_uring_buf_ring_create(sock_uring_t *ring, unsigned entries, int bgid);
+void sock_uring_buf_ring_free(sock_uring_t *ring, struct io_uring_buf_ring *br, unsigned entries, int bgid);
+void sock_uring_buf_ring_add(struct io_uring_buf_ring *br, unsigned entries, void *addr, unsigned len, int bid);
+
+#if defined(__cplusplus)
+}
+#endif
+
+#endif  /* SOCK_URING_H */
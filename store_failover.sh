@@ -0,0 +1,62 @@
+#!/bin/sh
+# store_failover.sh - measure the publisher hiccup caused by a Store failure.
+#
+# Runs the three quorum/consensus Stores for topic "topic1abc" (store_1a.xml,
+# store_1b.xml, store_1c.xml) on this host, starts um_perf_pub with interval
+# statistics, kills one Store mid-run with SIGKILL, and restarts it later.
+# The publisher's "stats," lines (send latency, flight size, and stability
+# latency per interval) can be lined up with the kill and restart times
+# printed by this script using the "ms_time" field.
+#
+# Environment variables (defaults in brackets):
+#   RATE - publisher message rate [100000]
+#   NUM_MSGS - publisher message count [6000000]
+#   STATS_MS - interval statistics period [100]
+#   KILL_STORE - which Store to kill: 1a, 1b, or 1c [1b]
+#   KILL_SEC - seconds after publisher start to kill the Store [20]
+#   DOWN_SEC - seconds the Store stays down before restart [10]
+#   PUB_CPU - publisher "-a" affinity CPU [1]
+
+. ./lbm.sh
+
+RATE=${RATE:-100000}
+NUM_MSGS=${NUM_MSGS:-6000000}
+STATS_MS=${STATS_MS:-100}
+KILL_STORE=${KILL_STORE:-1b}
+KILL_SEC=${KILL_SEC:-20}
+DOWN_SEC=${DOWN_SEC:-10}
+PUB_CPU=${PUB_CPU:-1}
+
+ms_time() { echo "`date +%s%3N`"; }
+
+for S in 1a 1b 1c; do :
+  umestored store_$S.xml >store_$S.log 2>&1 &
+  eval STORE_PID_$S=$!
+done
+echo "`ms_time`: Stores started"
+sleep 5
+
+./um_perf_pub -x um.xml -a $PUB_CPU -m 700 -n $NUM_MSGS -r $RATE \
+  -t topic1abc -w 15,5 -p r -i $STATS_MS >store_failover_pub.log 2>&1 &
+PUB_PID=$!
+echo "`ms_time`: um_perf_pub started"
+
+sleep $KILL_SEC
+eval KILL_PID=\$STORE_PID_$KILL_STORE
+kill -9 $KILL_PID
+echo "`ms_time`: killed store_$KILL_STORE"
+
+sleep $DOWN_SEC
+umestored store_$KILL_STORE.xml >>store_$KILL_STORE.log 2>&1 &
+eval STORE_PID_$KILL_STORE=$!
+echo "`ms_time`: restarted store_$KILL_STORE"
+
+wait $PUB_PID
+echo "`ms_time`: um_perf_pub exited with status $?"
+
+for S in 1a 1b 1c; do :
+  eval kill \$STORE_PID_$S
+done
+wait
+
+echo "Publisher output in store_failover_pub.log"
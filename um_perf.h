@@ -62,14 +62,31 @@ extern "C" {
 #define FLAGS_TIMESTAMP    0x01
 #define FLAGS_NON_BLOCKING 0x02
 #define FLAGS_GENERIC_SRC  0x04
+#define FLAGS_KEY          0x08
+#define FLAGS_EOS          0x10  /* End of stream (sock_perf). */
+#define FLAGS_KERNEL_TS    0x20  /* Kernel timestamps (sock_perf -K). */
+#define FLAGS_LOAD_BALANCE 0x40  /* msg_num spans the publisher's sources. */
 
 struct perf_msg_s {
   uint64_t flags;
   uint64_t msg_num;
   struct timespec send_ts;
+  uint64_t key;  /* Valid if FLAGS_KEY. */
 };
 typedef struct perf_msg_s perf_msg_t;
 
+/* Follows perf_msg_t if FLAGS_KERNEL_TS. The send_ts is then CLOCK_REALTIME,
+ * like the kernel's timestamps. A message's own kernel TX timestamp is only
+ * known after it is sent, so it is carried by a later message. */
+struct perf_kernel_ts_s {
+  uint64_t tx_msg_num;  /* (uint64_t)-1 if none yet. */
+  struct timespec tx_ts;
+};
+typedef struct perf_kernel_ts_s perf_kernel_ts_t;
+
+/* Transport statistics (-S): most transport sessions retrieved at a time. */
+#define MAX_XPORT_STATS 256
+
 #if defined(__cplusplus)
 }
 #endif
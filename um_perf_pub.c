@@ -43,12 +43,19 @@ static int o_affinity_cpu = -1;
 static char *o_config = NULL;
 static int o_generic_src = 0;
 static char *o_histogram = NULL;  /* -H */
+static int o_stats_ms = 0;  /* -i */
+static char *o_late_join = NULL;  /* -J */
+static int o_num_keys = 0;  /* -K */
 static int o_linger_ms = 1000;
 static int o_loss_percent = 0;  /* -L */
 static int o_msg_len = 0;
 static int o_num_msgs = 0;
 static char *o_persist = NULL;
+static char *o_transport = NULL;  /* -P */
 static int o_rate = 0;
+static char *o_rtt = NULL;  /* -R */
+static int o_xport_stats_ms = 0;  /* -S */
+static int o_timestamp = 0;  /* -T */
 static char *o_topics = NULL;
 static char *o_warmup = NULL;
 static char *o_xml_config = NULL;
@@ -57,6 +64,14 @@ static char *o_xml_config = NULL;
 char *app_name;
 int hist_num_buckets;
 int hist_ns_per_bucket;
+int late_join_msgs;
+#define RTT_NONE 0
+#define RTT_REQ 1   /* UM request/response. */
+#define RTT_PONG 2  /* Echoed on a separate topic. */
+int rtt_mode;
+int rtt_concurrency;
+char *rtt_pong_topic;
+int late_join_sec;
 int warmup_loops;
 int warmup_rate;
 
@@ -69,7 +84,7 @@ int cur_flight_size;
 int max_flight_size;
 
 
-char usage_str[] = "Usage: um_perf_pub [-h] [-a affinity_cpu] [-c config] [-g] [-H hist_num_buckets,hist_ns_per_bucket] [-l linger_ms] [-L loss_percent] [-m msg_len] [-n num_msgs] [-p persist_mode] [-r rate] [-t topics] [-w warmup_loops,warmup_rate] [-x xml_config]";
+char usage_str[] = "Usage: um_perf_pub [-h] [-a affinity_cpu] [-c config] [-g] [-H hist_num_buckets,hist_ns_per_bucket] [-i stats_ms] [-J late_join_msgs,late_join_sec] [-K num_keys] [-l linger_ms] [-L loss_percent] [-m msg_len] [-n num_msgs] [-p persist_mode] [-P transport] [-r rate] [-R rtt_mode,concurrency[,pong_topic]] [-S xport_stats_ms] [-T] [-t topics] [-w warmup_loops,warmup_rate] [-x xml_config]";
 
 void usage(char *msg) {
   if (msg) fprintf(stderr, "%s\n", msg);
@@ -86,18 +101,25 @@ void help() {
       "  -c config : configuration file; can be repeated [%s]\n"
       "  -g : generic source [%d]\n"
       "  -H hist_num_buckets,hist_ns_per_bucket : send time histogram [%s]\n"
+      "  -i stats_ms : interval statistics period (0=none) [%d]\n"
+      "  -J late_join_msgs,late_join_sec : messages to send, then pause, before measurement [%s]\n"
+      "  -K num_keys : give messages keys 0..num_keys-1, round-robin (0=none) [%d]\n"
       "  -l linger_ms : linger time before source delete [%d]\n"
       "  -L loss_percent : Source-side artificial packet loss (after warmup) [%d]\n"
       "  -m msg_len : message length [%d]\n"
       "  -n num_msgs : number of messages to send [%d]\n"
       "  -p ''|r|s : persist mode (empty=streaming, r=RPP, s=SPP) [%s]\n"
+      "  -P transport : source transport, overriding config (lbtrm, lbtru, tcp, lbtipc, lbtsmx) [%s]\n"
       "  -r rate : messages per second to send [%d]\n"
+      "  -R rtt_mode,concurrency[,pong_topic] : round-trip mode (req or pong,pong_topic) [%s]\n"
+      "  -S xport_stats_ms : transport statistics period (0=none) [%d]\n"
+      "  -T : timestamp messages for subscriber latency [%d]\n"
       "  -t topics : comma-separated topic strings [\"%s\"]\n"
       "  -w warmup_loops,warmup_rate : messages to send before measurement [%s]\n"
       "  -x xml_config : XML configuration file [%s]\n"
-      , o_affinity_cpu, o_config, o_generic_src, o_histogram, o_linger_ms
-      , o_loss_percent, o_msg_len, o_num_msgs, o_persist, o_rate, o_topics
-      , o_warmup, o_xml_config
+      , o_affinity_cpu, o_config, o_generic_src, o_histogram, o_stats_ms
+      , o_late_join, o_num_keys, o_linger_ms, o_loss_percent, o_msg_len, o_num_msgs, o_persist, o_transport, o_rate, o_rtt, o_xport_stats_ms
+      , o_timestamp, o_topics, o_warmup, o_xml_config
   );
   CPRT_NET_CLEANUP;
   exit(0);
@@ -112,12 +134,15 @@ void get_my_opts(int argc, char **argv)
   /* Set defaults for string options. */
   o_config = CPRT_STRDUP("");
   o_histogram = CPRT_STRDUP("0,0");
+  o_late_join = CPRT_STRDUP("0,0");
   o_persist = CPRT_STRDUP("");
+  o_rtt = CPRT_STRDUP("");
+  o_transport = CPRT_STRDUP("");
   o_topics = CPRT_STRDUP("");
   o_warmup = CPRT_STRDUP("0,0");
   o_xml_config = CPRT_STRDUP("");
 
-  while ((opt = cprt_getopt(argc, argv, "ha:c:gH:l:L:m:n:p:r:t:w:x:")) != EOF) {
+  while ((opt = cprt_getopt(argc, argv, "ha:c:gH:i:J:K:l:L:m:n:p:P:r:R:S:Tt:w:x:")) != EOF) {
     switch (opt) {
       case 'h': help(); break;
       case 'a': CPRT_ATOI(cprt_optarg, o_affinity_cpu); break;
@@ -128,12 +153,19 @@ void get_my_opts(int argc, char **argv)
                 break;
       case 'g': o_generic_src = 1; break;
       case 'H': free(o_histogram); o_histogram = CPRT_STRDUP(cprt_optarg); break;
+      case 'i': CPRT_ATOI(cprt_optarg, o_stats_ms); break;
+      case 'J': free(o_late_join); o_late_join = CPRT_STRDUP(cprt_optarg); break;
+      case 'K': CPRT_ATOI(cprt_optarg, o_num_keys); break;
       case 'l': CPRT_ATOI(cprt_optarg, o_linger_ms); break;
       case 'L': CPRT_ATOI(cprt_optarg, o_loss_percent); break;
       case 'm': CPRT_ATOI(cprt_optarg, o_msg_len); break;
       case 'n': CPRT_ATOI(cprt_optarg, o_num_msgs); break;
       case 'p': free(o_persist); o_persist = CPRT_STRDUP(cprt_optarg); break;
+      case 'P': free(o_transport); o_transport = CPRT_STRDUP(cprt_optarg); break;
       case 'r': CPRT_ATOI(cprt_optarg, o_rate); break;
+      case 'R': free(o_rtt); o_rtt = CPRT_STRDUP(cprt_optarg); break;
+      case 'S': CPRT_ATOI(cprt_optarg, o_xport_stats_ms); break;
+      case 'T': o_timestamp = 1; break;
       case 't': free(o_topics); o_topics = CPRT_STRDUP(cprt_optarg); break;
       case 'w': free(o_warmup); o_warmup = CPRT_STRDUP(cprt_optarg); break;
       case 'x': free(o_xml_config); o_xml_config = CPRT_STRDUP(cprt_optarg); break;
@@ -144,7 +176,7 @@ void get_my_opts(int argc, char **argv)
   /* Must supply certain required "options". */
   ASSRT(o_rate > 0);
   ASSRT(o_num_msgs > 0);
-  ASSRT(o_msg_len > 0);
+  ASSRT(o_msg_len >= sizeof(perf_msg_t));
   ASSRT(strlen(o_topics) > 0);  /* o_topics is parsed in create_sources(). */
 
   char *strtok_context;
@@ -164,6 +196,19 @@ void get_my_opts(int argc, char **argv)
   free(work_str);
   if (hist_num_buckets > 0) { ASSRT(hist_ns_per_bucket > 0); }
 
+  /* Parse the late join option: "late_join_msgs,late_join_sec". */
+  work_str = CPRT_STRDUP(o_late_join);
+  char *late_join_msgs_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(late_join_msgs_str != NULL);
+  CPRT_ATOI(late_join_msgs_str, late_join_msgs);
+
+  char *late_join_sec_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  ASSRT(late_join_sec_str != NULL);
+  CPRT_ATOI(late_join_sec_str, late_join_sec);
+
+  ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  free(work_str);
+
   if (strlen(o_persist) == 0) {
     app_name = "um_perf";
   }
@@ -177,6 +222,60 @@ void get_my_opts(int argc, char **argv)
     usage("Error, -p value must be '', 'r', or 's'\n");
   }
 
+  if (strlen(o_transport) > 0) {
+    if (strcmp(o_transport, "lbtrm") != 0 && strcmp(o_transport, "lbtru") != 0 &&
+        strcmp(o_transport, "tcp") != 0 && strcmp(o_transport, "lbtipc") != 0 &&
+        strcmp(o_transport, "lbtsmx") != 0)
+    {
+      usage("Error, -P value must be lbtrm, lbtru, tcp, lbtipc, or lbtsmx\n");
+    }
+    /* Smart Sources and persistence don't support LBT-SMX. */
+    if (strcmp(o_transport, "lbtsmx") == 0 && ! o_generic_src) {
+      usage("Error, -P lbtsmx requires -g\n");
+    }
+    if (strcmp(o_transport, "lbtsmx") == 0 && strlen(o_persist) > 0) {
+      usage("Error, -P lbtsmx requires streaming (-p '')\n");
+    }
+    /* The artificial loss is implemented for LBT-RM only. */
+    if (strcmp(o_transport, "lbtrm") != 0 && o_loss_percent > 0) {
+      usage("Error, -L requires -P lbtrm\n");
+    }
+  }
+
+  /* Parse the round-trip option: "rtt_mode,concurrency[,pong_topic]". */
+  if (strlen(o_rtt) > 0) {
+    work_str = CPRT_STRDUP(o_rtt);
+    char *rtt_mode_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+    ASSRT(rtt_mode_str != NULL);
+    char *rtt_concurrency_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+    ASSRT(rtt_concurrency_str != NULL);
+    CPRT_ATOI(rtt_concurrency_str, rtt_concurrency);
+    ASSRT(rtt_concurrency > 0);
+    if (strcmp(rtt_mode_str, "req") == 0) {
+      rtt_mode = RTT_REQ;
+      ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    }
+    else if (strcmp(rtt_mode_str, "pong") == 0) {
+      rtt_mode = RTT_PONG;
+      char *rtt_pong_topic_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+      ASSRT(rtt_pong_topic_str != NULL);
+      rtt_pong_topic = CPRT_STRDUP(rtt_pong_topic_str);
+      ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    }
+    else {
+      usage("Error, -R mode must be 'req' or 'pong'\n");
+    }
+    free(work_str);
+
+    /* Requests can only be sent on generic sources. */
+    if (! o_generic_src) {
+      usage("Error, -R requires -g\n");
+    }
+    if (strlen(o_persist) > 0 || late_join_msgs > 0) {
+      usage("Error, -R can't be combined with -p or -J\n");
+    }
+  }
+
   /* Parse the warmup option: "warmup_loops,warmup_rate". */
   work_str = CPRT_STRDUP(o_warmup);
   char *warmup_loops_str = CPRT_STRTOK(work_str, ",", &strtok_context);
@@ -203,18 +302,18 @@ void get_my_opts(int argc, char **argv)
 
 /* Histogram. */
 int *hist_buckets = NULL;
-int hist_min_sample = 999999999;
-int hist_max_sample = 0;
-int hist_overflows = 0;  /* Number of values above the last bucket. */
-int hist_num_samples = 0;
+uint64_t hist_min_sample = (uint64_t)-1;
+uint64_t hist_max_sample = 0;
+uint64_t hist_overflows = 0;  /* Number of values at or above the last bucket. */
+uint64_t hist_num_samples = 0;
 uint64_t hist_sample_sum = 0;
 
 void hist_init()
 {
   /* Re-initialize the data. */
-  hist_min_sample = 999999999;
+  hist_min_sample = (uint64_t)-1;
   hist_max_sample = 0;
-  hist_overflows = 0;  /* Number of values above the last bucket. */
+  hist_overflows = 0;
   hist_num_samples = 0;
   hist_sample_sum = 0;
 
@@ -232,10 +331,11 @@ void hist_create()
   hist_init();
 }  /* hist_create */
 
-void hist_input(int in_sample)
+/* Samples are 64-bit, so that long send or round-trip times are counted
+ * as overflows instead of wrapping negative. */
+void hist_input(uint64_t in_sample)
 {
   ASSRT(hist_buckets != NULL);
-  ASSRT(in_sample > 0);
 
   hist_num_samples++;
   hist_sample_sum += in_sample;
@@ -247,8 +347,8 @@ void hist_input(int in_sample)
     hist_min_sample = in_sample;
   }
 
-  int bucket = in_sample / hist_ns_per_bucket;
-  if (bucket >= hist_num_buckets) {
+  uint64_t bucket = in_sample / (uint64_t)hist_ns_per_bucket;
+  if (bucket >= (uint64_t)hist_num_buckets) {
     hist_overflows++;
   }
   else {
@@ -262,14 +362,208 @@ void hist_print()
   for (i = 0; i < hist_num_buckets; i++) {
     printf("%d\n", hist_buckets[i]);
   }
-  printf("o_histogram=%s, hist_overflows=%d, hist_min_sample=%d, hist_max_sample=%d,\n",
-      o_histogram, hist_overflows, hist_min_sample, hist_max_sample);
-  uint64_t average_sample = hist_sample_sum / (uint64_t)hist_num_samples;
-  printf("hist_num_samples=%d, average_sample=%d,\n",
-      hist_num_samples, (int)average_sample);
+  printf("o_histogram=%s, hist_overflows=%"PRIu64", hist_min_sample=%"PRIu64", hist_max_sample=%"PRIu64",\n",
+      o_histogram, hist_overflows,
+      (hist_num_samples == 0) ? 0 : hist_min_sample, hist_max_sample);
+  uint64_t average_sample = (hist_num_samples == 0) ?
+      0 : hist_sample_sum / hist_num_samples;
+  printf("hist_num_samples=%"PRIu64", average_sample=%"PRIu64",\n",
+      hist_num_samples, average_sample);
 }  /* hist_print */
 
 
+/* Interval statistics (-i). The totals are written by the sending thread
+ * (sends) and the context thread (stability), and sampled periodically by
+ * stats_thread(). The interval maximums are reset by the sampler, so an
+ * update that races with the reset can be lost; that is acceptable here. */
+#define STABLE_RING_SIZE (1 << 18)  /* Power of 2, larger than ume_flight_size. */
+struct stable_ring_entry_s {
+  uint64_t seq;
+  struct timespec send_ts;
+};
+struct stable_ring_entry_s *stable_ring = NULL;
+/* Also used as the message number, so it keeps counting across the warmup,
+ * late join, and measurement send loops. */
+uint64_t total_sends;
+uint64_t total_send_ns;
+uint64_t interval_max_send_ns;
+uint64_t total_stable_msgs;
+uint64_t total_stable_ns;
+uint64_t interval_max_stable_ns;
+int stats_exit;
+
+/* Save the send time of the next message for stable_input(). */
+void stable_ring_set(struct timespec *send_ts)
+{
+  struct stable_ring_entry_s *entry =
+      &stable_ring[total_sends & (STABLE_RING_SIZE - 1)];
+  entry->seq = total_sends;
+  entry->send_ts = *send_ts;
+}  /* stable_ring_set */
+
+void send_stats_input(uint64_t ns_send)
+{
+  total_send_ns += ns_send;
+  if (ns_send > interval_max_send_ns) {
+    interval_max_send_ns = ns_send;
+  }
+}  /* send_stats_input */
+
+/* Record stability latency of a message, identified by the UME message
+ * clientd set in send_loop() (seq + 1, so that 0 means "not set"). */
+void stable_input(void *msg_clientd)
+{
+  struct timespec stable_ts;
+  uint64_t seq = (uint64_t)(uintptr_t)msg_clientd;
+
+  if (seq == 0) {
+    return;  /* Not timed (e.g. sent before stats were enabled). */
+  }
+  seq--;
+  struct stable_ring_entry_s *entry = &stable_ring[seq & (STABLE_RING_SIZE - 1)];
+  if (entry->seq != seq) {
+    return;  /* Overwritten; flight size exceeds the ring. */
+  }
+
+  CPRT_GETTIME(&stable_ts);
+  uint64_t ns_stable;
+  CPRT_DIFF_TS(ns_stable, stable_ts, entry->send_ts);
+  total_stable_ns += ns_stable;
+  total_stable_msgs++;
+  if (ns_stable > interval_max_stable_ns) {
+    interval_max_stable_ns = ns_stable;
+  }
+}  /* stable_input */
+
+CPRT_THREAD_ENTRYPOINT stats_thread(void *in_arg)
+{
+  struct timespec start_ts;
+  struct timespec cur_ts;
+  uint64_t prev_sends = 0;
+  uint64_t prev_send_ns = 0;
+  uint64_t prev_stable_msgs = 0;
+  uint64_t prev_stable_ns = 0;
+
+  CPRT_GETTIME(&start_ts);
+  while (! stats_exit) {
+    usleep(o_stats_ms * 1000);
+
+    uint64_t elapsed_ns;
+    CPRT_GETTIME(&cur_ts);
+    CPRT_DIFF_TS(elapsed_ns, cur_ts, start_ts);
+
+    uint64_t sends = total_sends;
+    uint64_t send_ns = total_send_ns;
+    uint64_t stable_msgs = total_stable_msgs;
+    uint64_t stable_ns = total_stable_ns;
+    uint64_t max_send_ns = __sync_lock_test_and_set(&interval_max_send_ns, 0);
+    uint64_t max_stable_ns = __sync_lock_test_and_set(&interval_max_stable_ns, 0);
+
+    uint64_t interval_sends = sends - prev_sends;
+    uint64_t interval_stable_msgs = stable_msgs - prev_stable_msgs;
+
+    /* Leave "comma space" at end of line to make parsing output easier. */
+    printf("stats, ms_time=%"PRIu64", elapsed_ms=%"PRIu64", sends=%"PRIu64", flight_size=%d, send_ns_avg=%"PRIu64", send_ns_max=%"PRIu64", stable_msgs=%"PRIu64", stable_ns_avg=%"PRIu64", stable_ns_max=%"PRIu64", \n",
+        cprt_get_ms_time(), elapsed_ns / 1000000, interval_sends, cur_flight_size,
+        (interval_sends == 0) ? 0 : (send_ns - prev_send_ns) / interval_sends,
+        max_send_ns, interval_stable_msgs,
+        (interval_stable_msgs == 0) ? 0 : (stable_ns - prev_stable_ns) / interval_stable_msgs,
+        max_stable_ns);
+    fflush(stdout);
+
+    prev_sends = sends;
+    prev_send_ns = send_ns;
+    prev_stable_msgs = stable_msgs;
+    prev_stable_ns = stable_ns;
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* stats_thread */
+
+
+/* Transport statistics (-S). A low-priority thread periodically retrieves
+ * UM's context and source transport statistics and prints them as "xport"
+ * lines, which line up with the "stats" lines (-i) by ms_time. The values
+ * are UM's running totals since the context was created. */
+void xport_src_stats_print(uint64_t ms_time, lbm_src_transport_stats_t *st)
+{
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  switch (st->type) {
+    case LBM_TRANSPORT_STAT_LBTRM:
+      printf("xport src lbtrm, ms_time=%"PRIu64", source=%s, msgs_sent=%lu, bytes_sent=%lu, naks_rcved=%lu, naks_ignored=%lu, naks_shed=%lu, naks_rx_delay_ignored=%lu, rxs_sent=%lu, rctlr_data_msgs=%lu, rctlr_rx_msgs=%lu, \n",
+          ms_time, st->source, st->transport.lbtrm.msgs_sent, st->transport.lbtrm.bytes_sent,
+          st->transport.lbtrm.naks_rcved, st->transport.lbtrm.naks_ignored,
+          st->transport.lbtrm.naks_shed, st->transport.lbtrm.naks_rx_delay_ignored,
+          st->transport.lbtrm.rxs_sent, st->transport.lbtrm.rctlr_data_msgs,
+          st->transport.lbtrm.rctlr_rx_msgs);
+      break;
+    case LBM_TRANSPORT_STAT_LBTRU:
+      printf("xport src lbtru, ms_time=%"PRIu64", source=%s, msgs_sent=%lu, bytes_sent=%lu, num_clients=%lu, naks_rcved=%lu, naks_ignored=%lu, naks_shed=%lu, naks_rx_delay_ignored=%lu, rxs_sent=%lu, \n",
+          ms_time, st->source, st->transport.lbtru.msgs_sent, st->transport.lbtru.bytes_sent,
+          st->transport.lbtru.num_clients, st->transport.lbtru.naks_rcved,
+          st->transport.lbtru.naks_ignored, st->transport.lbtru.naks_shed,
+          st->transport.lbtru.naks_rx_delay_ignored, st->transport.lbtru.rxs_sent);
+      break;
+    case LBM_TRANSPORT_STAT_TCP:
+      printf("xport src tcp, ms_time=%"PRIu64", source=%s, num_clients=%lu, bytes_buffered=%lu, \n",
+          ms_time, st->source, st->transport.tcp.num_clients, st->transport.tcp.bytes_buffered);
+      break;
+    case LBM_TRANSPORT_STAT_LBTIPC:
+      printf("xport src lbtipc, ms_time=%"PRIu64", source=%s, num_clients=%lu, msgs_sent=%lu, bytes_sent=%lu, \n",
+          ms_time, st->source, st->transport.lbtipc.num_clients,
+          st->transport.lbtipc.msgs_sent, st->transport.lbtipc.bytes_sent);
+      break;
+    case LBM_TRANSPORT_STAT_LBTSMX:
+      printf("xport src lbtsmx, ms_time=%"PRIu64", source=%s, num_clients=%lu, msgs_sent=%lu, bytes_sent=%lu, \n",
+          ms_time, st->source, st->transport.lbtsmx.num_clients,
+          st->transport.lbtsmx.msgs_sent, st->transport.lbtsmx.bytes_sent);
+      break;
+    default:
+      printf("xport src %d, ms_time=%"PRIu64", source=%s, \n", st->type, ms_time, st->source);
+  }
+}  /* xport_src_stats_print */
+
+CPRT_THREAD_ENTRYPOINT xport_stats_thread(void *in_arg)
+{
+  lbm_context_t *ctx = (lbm_context_t *)in_arg;
+  lbm_context_stats_t ctx_stats;
+  lbm_src_transport_stats_t *src_stats;
+  int num_stats;
+  int i;
+
+  cprt_set_priority_low();
+  src_stats = (lbm_src_transport_stats_t *)malloc(
+      MAX_XPORT_STATS * sizeof(lbm_src_transport_stats_t));
+  ASSRT(src_stats != NULL);
+
+  while (! stats_exit) {
+    usleep(o_xport_stats_ms * 1000);
+    uint64_t ms_time = cprt_get_ms_time();
+
+    E(lbm_context_retrieve_stats(ctx, &ctx_stats));
+    printf("xport ctx, ms_time=%"PRIu64", dgrams_sent=%lu, dgrams_rcved=%lu, dgrams_dropped=%lu, dgrams_send_failed=%lu, send_blocked=%lu, send_would_block=%lu, fragments_lost=%lu, fragments_unrecoverably_lost=%lu, \n",
+        ms_time, ctx_stats.tr_dgrams_sent, ctx_stats.tr_dgrams_rcved,
+        ctx_stats.tr_dgrams_dropped_ver + ctx_stats.tr_dgrams_dropped_type +
+        ctx_stats.tr_dgrams_dropped_malformed,
+        ctx_stats.tr_dgrams_send_failed, ctx_stats.send_blocked,
+        ctx_stats.send_would_block, ctx_stats.fragments_lost,
+        ctx_stats.fragments_unrecoverably_lost);
+
+    num_stats = MAX_XPORT_STATS;
+    E(lbm_context_retrieve_src_transport_stats(ctx, &num_stats, src_stats));
+    for (i = 0; i < num_stats; i++) {
+      xport_src_stats_print(ms_time, &src_stats[i]);
+    }
+    fflush(stdout);
+  }
+
+  free(src_stats);
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* xport_stats_thread */
+
+
 /* Process source event. */
 int handle_src_event(int event, void *extra_data, void *client_data)
 {
@@ -290,9 +584,16 @@ int handle_src_event(int event, void *extra_data, void *client_data)
       registration_complete++;
       break;
     case LBM_SRC_EVENT_UME_MESSAGE_STABLE_EX:
+    {
       __sync_fetch_and_sub(&cur_flight_size, 1);
       ASSRT(cur_flight_size >= 0);  /* Die if negative. */
+      if (stable_ring != NULL) {
+        lbm_src_event_ume_ack_ex_info_t *ack_info =
+            (lbm_src_event_ume_ack_ex_info_t *)extra_data;
+        stable_input(ack_info->msg_clientd);
+      }
       break;
+    }
     case LBM_SRC_EVENT_SEQUENCE_NUMBER_INFO:
       break;
     case LBM_SRC_EVENT_FLIGHT_SIZE_NOTIFICATION:
@@ -358,6 +659,10 @@ void create_sources(lbm_context_t *ctx)
   E(lbm_src_topic_attr_create(&src_attr));
 
   E(lbm_src_topic_attr_str_setopt(src_attr, "ume_session_id", "0x6"));
+  if (strlen(o_transport) > 0) {
+    /* Overrides the configuration's "transport" (lbtrm in um.xml). */
+    E(lbm_src_topic_attr_str_setopt(src_attr, "transport", o_transport));
+  }
 
   /* Get notified for forced reclaims (should not happen). */
   lbm_ume_src_force_reclaim_func_t force_reclaim_cb_conf;
@@ -418,19 +723,46 @@ int send_loop(int num_sends, uint64_t sends_per_sec)
   uint64_t num_sent;
   int lbm_send_flags, max_tight_sends;
   static lbm_ssrc_send_ex_info_t ssrc_exinfo;
+  static lbm_src_send_ex_info_t src_exinfo;
   int local_cur_src;
 
-  /* Set up local variable so that test is fast. */
+  /* Set up local variables so that test is fast. */
   int do_histogram = 0;
   if (hist_buckets != NULL) {
       do_histogram = 1;
   }
+  int do_stats = 0;
+  if (stable_ring != NULL) {
+    do_stats = 1;
+  }
+  int do_timestamp = o_timestamp;
+  uint64_t msg_flags = 0;
+  if (do_timestamp) {
+    msg_flags |= FLAGS_TIMESTAMP;
+  }
+  int do_key = (o_num_keys > 0);
+  if (do_key) {
+    msg_flags |= FLAGS_KEY;
+  }
+  /* One msg_num sequence is spread round-robin over the sources. */
+  if (num_srcs > 1) {
+    msg_flags |= FLAGS_LOAD_BALANCE;
+  }
 
   if (o_generic_src) {
+    memset(&src_exinfo, 0, sizeof(src_exinfo));
+    if (do_stats) {
+      /* Pass a message clientd to the stability event. */
+      src_exinfo.flags = LBM_SRC_SEND_EX_FLAG_UME_CLIENTD;
+    }
     lbm_send_flags = LBM_SRC_NONBLOCK;
   }
   else {  /* Smart Src API. */
     memset(&ssrc_exinfo, 0, sizeof(ssrc_exinfo));
+    if (do_stats) {
+      /* Pass a message clientd to the stability event. */
+      ssrc_exinfo.flags = LBM_SSRC_SEND_EX_FLAG_UME_CLIENTD;
+    }
     lbm_send_flags = 0;
   }
 
@@ -460,40 +792,69 @@ int send_loop(int num_sends, uint64_t sends_per_sec)
     while (num_sent < should_have_sent) {
       if (o_generic_src) {
         /* Construct message. */
-        perf_msg->msg_num = num_sent;
-        perf_msg->flags = 0;
+        perf_msg->msg_num = total_sends;
+        perf_msg->flags = msg_flags;
+        if (do_key) {
+          perf_msg->key = total_sends % o_num_keys;
+        }
+        if (do_timestamp) {
+          CPRT_GETTIME(&perf_msg->send_ts);
+        }
 
         struct timespec send_start_ts;
-        if (do_histogram) {
+        if (do_histogram || do_stats) {
           CPRT_GETTIME(&send_start_ts);
         }
 
         /* Send message. */
-        int e = lbm_src_send(srcs[local_cur_src], (void *)perf_msg, o_msg_len, lbm_send_flags);
+        int e;
+        if (do_stats) {
+          stable_ring_set(&send_start_ts);
+          src_exinfo.ume_msg_clientd = (void *)(uintptr_t)(total_sends + 1);
+          e = lbm_src_send_ex(srcs[local_cur_src], (void *)perf_msg, o_msg_len, lbm_send_flags, &src_exinfo);
+        }
+        else {
+          e = lbm_src_send(srcs[local_cur_src], (void *)perf_msg, o_msg_len, lbm_send_flags);
+        }
         if (e == -1) {
           printf("num_sent=%"PRIu64", global_max_tight_sends=%d, max_flight_size=%d\n",
               num_sent, global_max_tight_sends, max_flight_size);
         }
         E(e);  /* If error, print message and fail. */
 
-        if (do_histogram) {
+        if (do_histogram || do_stats) {
           struct timespec send_return_ts;
           CPRT_GETTIME(&send_return_ts);
           uint64_t ns_send;
           CPRT_DIFF_TS(ns_send, send_return_ts, send_start_ts);
-          hist_input((int)ns_send);
+          if (do_histogram) {
+            hist_input(ns_send);
+          }
+          if (do_stats) {
+            send_stats_input(ns_send);
+          }
         }
       }
       else {  /* Smart Src API. */
         perf_msg = (perf_msg_t *)ssrc_buffs[local_cur_src];
         /* Construct message in shared memory buffer. */
-        perf_msg->msg_num = num_sent;
-        perf_msg->flags = 0;
+        perf_msg->msg_num = total_sends;
+        perf_msg->flags = msg_flags;
+        if (do_key) {
+          perf_msg->key = total_sends % o_num_keys;
+        }
+        if (do_timestamp) {
+          CPRT_GETTIME(&perf_msg->send_ts);
+        }
 
         struct timespec send_start_ts;
-        if (do_histogram) {
+        if (do_histogram || do_stats) {
           CPRT_GETTIME(&send_start_ts);
         }
+        if (do_stats) {
+          stable_ring_set(&send_start_ts);
+          ssrc_exinfo.ume_msg_clientd = (void *)(uintptr_t)(total_sends + 1);
+        }
 
         /* Send message and get next buffer from shared memory. */
         int e = lbm_ssrc_send_ex(ssrcs[local_cur_src], (char *)perf_msg, o_msg_len, lbm_send_flags, &ssrc_exinfo);
@@ -503,15 +864,21 @@ int send_loop(int num_sends, uint64_t sends_per_sec)
         }
         E(e);  /* If error, print message and fail. */
 
-        if (do_histogram) {
+        if (do_histogram || do_stats) {
           struct timespec send_return_ts;
           CPRT_GETTIME(&send_return_ts);
           uint64_t ns_send;
           CPRT_DIFF_TS(ns_send, send_return_ts, send_start_ts);
-          hist_input((int)ns_send);
+          if (do_histogram) {
+            hist_input(ns_send);
+          }
+          if (do_stats) {
+            send_stats_input(ns_send);
+          }
         }
       }
 
+      total_sends++;
       int cur = __sync_fetch_and_add(&cur_flight_size, 1);
       if (cur > max_flight_size) {
         max_flight_size = cur;
@@ -536,6 +903,230 @@ int send_loop(int num_sends, uint64_t sends_per_sec)
 }  /* send_loop */
 
 
+/* Round-trip mode (-R). Each request carries its msg_num and send time, and
+ * um_perf_sub -R echoes it back unchanged, either as a UM response ("req")
+ * or as a message on the pong topic ("pong"). Up to rtt_concurrency requests
+ * are outstanding; request msg_num uses slot (msg_num % rtt_concurrency), so
+ * when all are in use the sender waits for the oldest one. A request that
+ * isn't answered within RTT_TIMEOUT_MS is counted as timed out, and its slot
+ * is reused. In this mode, the -H histogram records round-trip times. */
+#define RTT_TIMEOUT_MS 1000
+struct rtt_slot_s {
+  volatile uint64_t pending;  /* msg_num + 1 of the outstanding request; 0 if free. */
+  struct timespec send_ts;
+  lbm_request_t *req;  /* RTT_REQ; deleted by the sender when reused. */
+};
+struct rtt_slot_s *rtt_slots;
+lbm_rcv_t *rtt_pong_rcv;
+/* Written by the context thread. */
+uint64_t rtt_rcvs;
+uint64_t rtt_unmatched;  /* Late (after timeout), duplicate, or not a request. */
+uint64_t rtt_min_ns;
+uint64_t rtt_max_ns;
+uint64_t rtt_sum_ns;
+/* Written by the sending thread. */
+uint64_t rtt_timeouts;
+uint64_t rtt_waits;  /* Sends delayed by the concurrency limit. */
+
+void rtt_stats_init()
+{
+  rtt_rcvs = 0;
+  rtt_unmatched = 0;
+  rtt_min_ns = (uint64_t)-1;  /* max int */
+  rtt_max_ns = 0;
+  rtt_sum_ns = 0;
+  rtt_timeouts = 0;
+  rtt_waits = 0;
+}  /* rtt_stats_init */
+
+/* Called by the context thread for each response or pong. */
+void rtt_response_input(const char *data, size_t len)
+{
+  perf_msg_t *resp_msg = (perf_msg_t *)data;
+  struct timespec rcv_ts;
+
+  CPRT_GETTIME(&rcv_ts);
+  if (len < sizeof(perf_msg_t)) {
+    rtt_unmatched++;
+    return;
+  }
+  struct rtt_slot_s *slot = &rtt_slots[resp_msg->msg_num % rtt_concurrency];
+  uint64_t rtt_ns;
+  CPRT_DIFF_TS(rtt_ns, rcv_ts, resp_msg->send_ts);
+  /* A reply after RTT_TIMEOUT_MS is late even if the sender hasn't gotten
+   * around to timing out the slot yet; free the slot but don't count it. */
+  if (rtt_ns > (uint64_t)RTT_TIMEOUT_MS * 1000000) {
+    (void)__sync_bool_compare_and_swap(&slot->pending, resp_msg->msg_num + 1, 0);
+    rtt_unmatched++;
+    return;
+  }
+  if (! __sync_bool_compare_and_swap(&slot->pending, resp_msg->msg_num + 1, 0)) {
+    rtt_unmatched++;
+    return;
+  }
+
+  if (rtt_ns < rtt_min_ns) rtt_min_ns = rtt_ns;
+  if (rtt_ns > rtt_max_ns) rtt_max_ns = rtt_ns;
+  rtt_sum_ns += rtt_ns;
+  rtt_rcvs++;
+  if (hist_buckets != NULL) {
+    hist_input(rtt_ns);
+  }
+}  /* rtt_response_input */
+
+int rtt_response_cb(lbm_request_t *req, lbm_msg_t *msg, void *clientd)
+{
+  if (msg->type == LBM_MSG_RESPONSE) {
+    rtt_response_input(msg->data, msg->len);
+  }
+  return 0;
+}  /* rtt_response_cb */
+
+int rtt_pong_rcv_cb(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
+{
+  if (msg->type == LBM_MSG_DATA) {
+    rtt_response_input(msg->data, msg->len);
+  }
+  return 0;
+}  /* rtt_pong_rcv_cb */
+
+void rtt_create(lbm_context_t *ctx)
+{
+  lbm_topic_t *topic_obj;
+
+  rtt_slots = (struct rtt_slot_s *)calloc(rtt_concurrency, sizeof(struct rtt_slot_s));
+  ASSRT(rtt_slots != NULL);
+  rtt_stats_init();
+
+  if (rtt_mode == RTT_PONG) {
+    E(lbm_rcv_topic_lookup(&topic_obj, ctx, rtt_pong_topic, NULL));
+    E(lbm_rcv_create(&rtt_pong_rcv, ctx, topic_obj, rtt_pong_rcv_cb, NULL, NULL));
+  }
+}  /* rtt_create */
+
+/* Wait for a slot's outstanding request to be answered or time out. */
+void rtt_slot_wait(struct rtt_slot_s *slot)
+{
+  uint64_t pending = slot->pending;
+
+  if (pending == 0) {
+    return;
+  }
+  rtt_waits++;
+  while (pending != 0) {
+    struct timespec cur_ts;
+    uint64_t outstanding_ns;
+    CPRT_GETTIME(&cur_ts);
+    CPRT_DIFF_TS(outstanding_ns, cur_ts, slot->send_ts);
+    if (outstanding_ns > (uint64_t)RTT_TIMEOUT_MS * 1000000) {
+      if (__sync_bool_compare_and_swap(&slot->pending, pending, 0)) {
+        rtt_timeouts++;
+      }
+    }
+    pending = slot->pending;
+  }
+}  /* rtt_slot_wait */
+
+/* Wait for all outstanding requests. */
+void rtt_drain()
+{
+  int i;
+
+  for (i = 0; i < rtt_concurrency; i++) {
+    rtt_slot_wait(&rtt_slots[i]);
+    if (rtt_slots[i].req != NULL) {
+      E(lbm_request_delete(rtt_slots[i].req));
+      rtt_slots[i].req = NULL;
+    }
+  }
+}  /* rtt_drain */
+
+/* Like send_loop(), but each message is a request (generic sources only). */
+int rtt_loop(int num_sends, uint64_t sends_per_sec)
+{
+  struct timespec cur_ts;
+  struct timespec start_ts;
+  uint64_t num_sent;
+  int local_cur_src = global_cur_src;
+  int last_src = num_srcs - 1;
+  uint64_t msg_flags = FLAGS_TIMESTAMP;
+  int do_key = (o_num_keys > 0);
+  if (do_key) {
+    msg_flags |= FLAGS_KEY;
+  }
+  if (num_srcs > 1) {
+    msg_flags |= FLAGS_LOAD_BALANCE;
+  }
+
+  perf_msg = (perf_msg_t *)msg_buf;
+
+  CPRT_GETTIME(&start_ts);
+  cur_ts = start_ts;
+  num_sent = 0;
+  do {  /* while num_sent < num_sends */
+    uint64_t ns_so_far;
+    CPRT_DIFF_TS(ns_so_far, cur_ts, start_ts);
+    /* The +1 is because we want to send, then pause. */
+    uint64_t should_have_sent = (ns_so_far * sends_per_sec)/1000000000 + 1;
+    if (should_have_sent > num_sends) {
+      should_have_sent = num_sends;
+    }
+
+    while (num_sent < should_have_sent) {
+      struct rtt_slot_s *slot = &rtt_slots[total_sends % rtt_concurrency];
+      rtt_slot_wait(slot);
+      if (slot->req != NULL) {
+        E(lbm_request_delete(slot->req));
+        slot->req = NULL;
+      }
+
+      /* Construct message. */
+      perf_msg->msg_num = total_sends;
+      perf_msg->flags = msg_flags;
+      if (do_key) {
+        perf_msg->key = total_sends % o_num_keys;
+      }
+      CPRT_GETTIME(&perf_msg->send_ts);
+      slot->send_ts = perf_msg->send_ts;
+      __sync_synchronize();  /* send_ts before pending. */
+      slot->pending = total_sends + 1;
+
+      if (rtt_mode == RTT_REQ) {
+        E(lbm_send_request(&slot->req, srcs[local_cur_src], (const char *)perf_msg,
+            o_msg_len, NULL, rtt_response_cb, NULL, LBM_SRC_NONBLOCK));
+      }
+      else {
+        E(lbm_src_send(srcs[local_cur_src], (const char *)perf_msg, o_msg_len,
+            LBM_SRC_NONBLOCK));
+      }
+
+      total_sends++;
+      if (local_cur_src == last_src) {
+        local_cur_src = 0;
+      }
+      else {
+        local_cur_src++;
+      }
+      num_sent++;
+    }  /* while num_sent < should_have_sent */
+    CPRT_GETTIME(&cur_ts);
+  } while (num_sent < num_sends);
+
+  global_cur_src = local_cur_src;
+
+  return num_sent;
+}  /* rtt_loop */
+
+void rtt_print(int actual_sends)
+{
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  printf("rtt_sends=%d, rtt_rcvs=%"PRIu64", rtt_timeouts=%"PRIu64", rtt_unmatched=%"PRIu64", rtt_waits=%"PRIu64", rtt_min_ns=%"PRIu64", rtt_avg_ns=%"PRIu64", rtt_max_ns=%"PRIu64", \n",
+      actual_sends, rtt_rcvs, rtt_timeouts, rtt_unmatched, rtt_waits,
+      (rtt_rcvs == 0) ? 0 : rtt_min_ns,
+      (rtt_rcvs == 0) ? 0 : rtt_sum_ns / rtt_rcvs, rtt_max_ns);
+}  /* rtt_print */
+
+
 int main(int argc, char **argv)
 {
   uint64_t cpuset;
@@ -545,6 +1136,8 @@ int main(int argc, char **argv)
   uint64_t duration_ns;
   int actual_sends;
   double result_rate;
+  CPRT_THREAD_T stats_thread_id;
+  CPRT_THREAD_T xport_stats_thread_id;
   CPRT_NET_START;
 
   CPRT_INITTIME();
@@ -556,14 +1149,26 @@ int main(int argc, char **argv)
   }
 
   /* Leave "comma space" at end of line to make parsing output easier. */
-  printf("o_affinity_cpu=%d, o_config=%s, o_generic_src=%d, o_histogram=%s, o_linger_ms=%d, o_loss_percent=%d, o_msg_len=%d, o_num_msgs=%d, o_persist='%s', o_rate=%d, o_topics='%s', o_warmup=%s, xml_config=%s, \n",
-      o_affinity_cpu, o_config, o_generic_src, o_histogram, o_linger_ms, o_loss_percent, o_msg_len, o_num_msgs, o_persist, o_rate, o_topics, o_warmup, o_xml_config);
+  printf("o_affinity_cpu=%d, o_config=%s, o_generic_src=%d, o_histogram=%s, o_stats_ms=%d, o_late_join=%s, o_num_keys=%d, o_linger_ms=%d, o_loss_percent=%d, o_msg_len=%d, o_num_msgs=%d, o_persist='%s', o_transport='%s', o_rate=%d, o_rtt='%s', o_xport_stats_ms=%d, o_timestamp=%d, o_topics='%s', o_warmup=%s, xml_config=%s, \n",
+      o_affinity_cpu, o_config, o_generic_src, o_histogram, o_stats_ms, o_late_join, o_num_keys, o_linger_ms, o_loss_percent, o_msg_len, o_num_msgs, o_persist, o_transport, o_rate, o_rtt, o_xport_stats_ms, o_timestamp, o_topics, o_warmup, o_xml_config);
 
   msg_buf = (char *)malloc(o_msg_len);
 
   /* Context thread inherits the initial CPU set of the process. */
   E(lbm_context_create(&ctx, NULL, NULL, NULL));
 
+  if (o_stats_ms > 0) {
+    stable_ring = (struct stable_ring_entry_s *)malloc(
+        STABLE_RING_SIZE * sizeof(struct stable_ring_entry_s));
+    ASSRT(stable_ring != NULL);
+    memset(stable_ring, 0xff, STABLE_RING_SIZE * sizeof(struct stable_ring_entry_s));
+    /* Like the context thread, inherits the initial CPU set. */
+    CPRT_THREAD_CREATE(stats_thread_id, stats_thread, NULL);
+  }
+  if (o_xport_stats_ms > 0) {
+    CPRT_THREAD_CREATE(xport_stats_thread_id, xport_stats_thread, ctx);
+  }
+
   /* Pin time-critical thread (sending thread) to requested CPU core. */
   if (o_affinity_cpu > -1) {
     CPRT_CPU_ZERO(&cpuset);
@@ -571,6 +1176,9 @@ int main(int argc, char **argv)
     cprt_set_affinity(cpuset);
   }
 
+  if (rtt_mode != RTT_NONE) {
+    rtt_create(ctx);
+  }
   create_sources(ctx);
 
   if (strlen(o_persist) > 0) {
@@ -601,20 +1209,49 @@ int main(int argc, char **argv)
 
   if (warmup_loops > 0) {
     /* Warmup loops to get CPU caches loaded. */
-    send_loop(warmup_loops, warmup_rate);
+    if (rtt_mode != RTT_NONE) {
+      rtt_loop(warmup_loops, warmup_rate);
+    }
+    else {
+      send_loop(warmup_loops, warmup_rate);
+    }
+  }
+
+  if (late_join_msgs > 0) {
+    /* Build up a backlog (in the Store, for persistence) for a late-joining
+     * subscriber to recover. The subscriber is started during the pause so
+     * that its recovery overlaps the measured send loop below. */
+    send_loop(late_join_msgs, o_rate);
+    printf("Sent %d late join messages, pausing %d sec.\n",
+        late_join_msgs, late_join_sec);
+    fflush(stdout);
+    sleep(late_join_sec);
   }
 
   if (o_loss_percent > 0) {
     lbm_set_lbtrm_src_loss_rate(o_loss_percent);
   }
 
+  if (rtt_mode != RTT_NONE) {
+    rtt_drain();
+    rtt_stats_init();
+  }
+
   /* Measure overall send rate by timing the main send loop. */
   if (hist_buckets != NULL) {
     hist_init();  /* Zero out data from warmup period. */
   }
   CPRT_GETTIME(&start_ts);
-  actual_sends = send_loop(o_num_msgs, o_rate);
+  if (rtt_mode != RTT_NONE) {
+    actual_sends = rtt_loop(o_num_msgs, o_rate);
+  }
+  else {
+    actual_sends = send_loop(o_num_msgs, o_rate);
+  }
   CPRT_GETTIME(&end_ts);
+  if (rtt_mode != RTT_NONE) {
+    rtt_drain();  /* Not timed, but all responses are in the statistics. */
+  }
   CPRT_DIFF_TS(duration_ns, end_ts, start_ts);
 
   result_rate = (double)(duration_ns);
@@ -630,6 +1267,9 @@ int main(int argc, char **argv)
   if (hist_buckets != NULL) {
     hist_print();
   }
+  if (rtt_mode != RTT_NONE) {
+    rtt_print(actual_sends);
+  }
 
   /* Leave "comma space" at end of line to make parsing output easier. */
   printf("actual_sends=%d, duration_ns=%"PRIu64", result_rate=%f, global_max_tight_sends=%d, max_flight_size=%d\n",
@@ -654,6 +1294,18 @@ int main(int argc, char **argv)
     usleep(o_linger_ms * 1000);
   }
 
+  if (o_stats_ms > 0) {
+    stats_exit = 1;
+    CPRT_THREAD_JOIN(stats_thread_id);
+  }
+  if (o_xport_stats_ms > 0) {
+    stats_exit = 1;
+    CPRT_THREAD_JOIN(xport_stats_thread_id);
+  }
+
+  if (rtt_pong_rcv != NULL) {
+    E(lbm_rcv_delete(rtt_pong_rcv));
+  }
   delete_sources();
 
   E(lbm_context_delete(ctx));
@@ -23,6 +23,7 @@
 #include "cprt.h"
 #include <stdio.h>
 #include <string.h>
+#include <stddef.h>
 #if ! defined(_WIN32)
   #include <stdlib.h>
   #include <unistd.h>
@@ -33,19 +34,60 @@
 
 /* Command-line options and their defaults. String defaults are set
  * in "get_my_opts()". */
+static char *o_ack = NULL;  /* -A */
 static int o_affinity_cpu = -1;
 static char *o_config = NULL;
+static char *o_conflate = NULL;  /* -C */
 static int o_exit_on_eos = 0;  /* -E */
+static char *o_histogram = NULL;  /* -H */
+static char *o_offload = NULL;  /* -O */
 static char *o_persist = NULL;
+static char *o_transport = NULL;  /* -P */
+static int o_evq_sample_ms = 0;  /* -Q */
+static char *o_rtt = NULL;  /* -R */
+static int o_xport_stats_ms = 0;  /* -S */
 static int o_spin_cnt = 0;
 static char *o_topics = NULL;
+static char *o_workload = NULL;  /* -W */
+static char *o_xsps = NULL;  /* -X */
+static int o_zero_copy = 0;  /* -Z */
 static char *o_xml_config = NULL;
 
-/* Globals. The code depends on the loader initializing them to all zeros. */
+/* Parameters parsed out from command-line options. */
 char *app_name;
+int hist_num_buckets;
+int hist_ns_per_bucket;
+#define WORKLOAD_NONE 0
+#define WORKLOAD_SPIN 1   /* Empty loop; param = loop count. */
+#define WORKLOAD_PARSE 2  /* Decode fixed-layout fields; param = num fields. */
+#define WORKLOAD_BOOK 3   /* Order book hash table; param = num keys. */
+#define WORKLOAD_TOUCH 4  /* Random cache lines; param = working set bytes. */
+int workload_type;
+int workload_param;
+int num_workers;
+int worker_ring_slots;
+int worker_first_cpu = -1;
+int worker_batch_size = 1;
+int conflate_num_keys;
+int conflate_cpu = -1;
+int num_xsps;
+int xsp_first_cpu = -1;
+#define RTT_NONE 0
+#define RTT_REQ 1   /* Answer UM requests. */
+#define RTT_PONG 2  /* Echo messages on a separate topic. */
+int rtt_mode;
+char *rtt_pong_topic;
+char *transport_source_prefix;  /* Expected start of msg->source (-P). */
+int ack_batch_msgs;
+int ack_interval_us;
+int do_explicit_ack;
+
+/* Globals. The code depends on the loader initializing them to all zeros. */
+volatile int exit_requested;  /* By rcv_callback(), at the last EOS with -E. */
+volatile int stats_exit;  /* Stops the statistics thread (-S). */
 
 
-char usage_str[] = "Usage: um_perf_sub [-h] [-a affinity_cpu] [-c config] [-E] [-p persist_mode] [-s spin_cnt] [-t topics] [-x xml_config]";
+char usage_str[] = "Usage: um_perf_sub [-h] [-A ack_msgs[,ack_us]] [-a affinity_cpu] [-c config] [-C num_keys[,cpu]] [-E] [-H hist_num_buckets,hist_ns_per_bucket] [-O num_workers,ring_slots[,first_cpu[,batch_size]]] [-p persist_mode] [-P transport] [-Q evq_sample_ms] [-R rtt_mode[,pong_topic]] [-S xport_stats_ms] [-s spin_cnt] [-t topics] [-W workload,param] [-x xml_config] [-X num_xsps[,first_cpu]] [-Z]";
 
 void usage(char *msg) {
   if (msg) fprintf(stderr, "%s\n", msg);
@@ -58,15 +100,26 @@ void help() {
   fprintf(stderr, "%s\n", usage_str);
   fprintf(stderr, "where:\n"
       "  -h : print help\n"
+      "  -A ack_msgs[,ack_us] : explicit ack every ack_msgs messages and/or ack_us microseconds [%s]\n"
       "  -a affinity_cpu : CPU number (0..N-1) for receive thread [%d]\n"
       "  -c config : configuration file; can be repeated [%s]\n"
+      "  -C num_keys[,cpu] : conflate by key for a consumer thread [%s]\n"
       "  -E : exit on EOS [%d]\n"
+      "  -H hist_num_buckets,hist_ns_per_bucket : recovery histograms [%s]\n"
+      "  -O num_workers,ring_slots[,first_cpu[,batch_size]] : offload work to worker threads [%s]\n"
       "  -p ''|r|s : persist mode (empty=streaming, r=RPP, s=SPP) [%s]\n"
-      "  -s spin_cnt : empty loop inside receiver callback [%d]\n"
+      "  -P transport : expected source transport (lbtrm, lbtru, tcp, lbtipc, lbtsmx) [%s]\n"
+      "  -Q evq_sample_ms : deliver via event queue (-a pins its dispatch thread), sampling it every evq_sample_ms [%d]\n"
+      "  -R rtt_mode[,pong_topic] : echo messages back (req or pong,pong_topic) [%s]\n"
+      "  -S xport_stats_ms : transport statistics period (0=none) [%d]\n"
+      "  -s spin_cnt : empty loop inside receiver callback (same as -W spin,spin_cnt) [%d]\n"
       "  -t topics : comma-separated topic strings to subscribe [%s]\n"
+      "  -W workload,param : receiver work per message (spin,loops parse,num_fields book,num_keys touch,bytes) [%s]\n"
       "  -x xml_config : configuration file [%s]\n"
-      , o_affinity_cpu, o_config, o_exit_on_eos, o_persist, o_spin_cnt
-      , o_topics, o_xml_config
+      "  -X num_xsps[,first_cpu] : receive on XSPs, round-robin by transport session [%s]\n"
+      "  -Z : zero-copy; workers get retained messages instead of copies [%d]\n"
+      , o_ack, o_affinity_cpu, o_config, o_conflate, o_exit_on_eos, o_histogram, o_offload, o_persist, o_transport, o_evq_sample_ms, o_rtt, o_xport_stats_ms, o_spin_cnt
+      , o_topics, o_workload, o_xml_config, o_xsps, o_zero_copy
   );
   CPRT_NET_CLEANUP;
   exit(0);
@@ -79,25 +132,44 @@ void get_my_opts(int argc, char **argv)
   int opt;  /* Loop variable for getopt(). */
 
   /* Set defaults for string options. */
+  o_ack = CPRT_STRDUP("0");
   o_config = CPRT_STRDUP("");
+  o_conflate = CPRT_STRDUP("0");
+  o_histogram = CPRT_STRDUP("0,0");
+  o_offload = CPRT_STRDUP("0,0");
   o_persist = CPRT_STRDUP("");
+  o_rtt = CPRT_STRDUP("");
+  o_transport = CPRT_STRDUP("");
   o_topics = CPRT_STRDUP("");
+  o_workload = CPRT_STRDUP("");
   o_xml_config = CPRT_STRDUP("");
+  o_xsps = CPRT_STRDUP("0");
 
-  while ((opt = cprt_getopt(argc, argv, "ha:c:Ep:s:t:x:")) != EOF) {
+  while ((opt = cprt_getopt(argc, argv, "hA:a:c:C:EH:O:p:P:Q:R:S:s:t:W:x:X:Z")) != EOF) {
     switch (opt) {
       case 'h': help(); break;
+      case 'A': free(o_ack); o_ack = CPRT_STRDUP(cprt_optarg); break;
       case 'a': CPRT_ATOI(cprt_optarg, o_affinity_cpu); break;
       /* Allow -c to be repeated, loading each config file in succession. */
       case 'c': free(o_config);
                 o_config = CPRT_STRDUP(cprt_optarg);
                 E(lbm_config(o_config));  /* Allow multiple calls. */
                 break;
+      case 'C': free(o_conflate); o_conflate = CPRT_STRDUP(cprt_optarg); break;
       case 'E': o_exit_on_eos = 1; break;
+      case 'H': free(o_histogram); o_histogram = CPRT_STRDUP(cprt_optarg); break;
+      case 'O': free(o_offload); o_offload = CPRT_STRDUP(cprt_optarg); break;
       case 'p': free(o_persist); o_persist = CPRT_STRDUP(cprt_optarg); break;
+      case 'P': free(o_transport); o_transport = CPRT_STRDUP(cprt_optarg); break;
+      case 'Q': CPRT_ATOI(cprt_optarg, o_evq_sample_ms); break;
+      case 'R': free(o_rtt); o_rtt = CPRT_STRDUP(cprt_optarg); break;
+      case 'S': CPRT_ATOI(cprt_optarg, o_xport_stats_ms); break;
       case 's': CPRT_ATOI(cprt_optarg, o_spin_cnt); break;
       case 't': free(o_topics); o_topics = CPRT_STRDUP(cprt_optarg); break;
+      case 'W': free(o_workload); o_workload = CPRT_STRDUP(cprt_optarg); break;
       case 'x': free(o_xml_config); o_xml_config = CPRT_STRDUP(cprt_optarg); break;
+      case 'X': free(o_xsps); o_xsps = CPRT_STRDUP(cprt_optarg); break;
+      case 'Z': o_zero_copy = 1; break;
       default: usage(NULL);
     }  /* switch opt */
   }  /* while getopt */
@@ -105,6 +177,191 @@ void get_my_opts(int argc, char **argv)
   /* Must supply certain required "options". */
   ASSRT(strlen(o_topics) > 0);  /* o_topics is parsed in main(). */
 
+  char *strtok_context;
+
+  /* Parse the histogram option: "hist_num_buckets,hist_ns_per_bucket". */
+  char *work_str = CPRT_STRDUP(o_histogram);
+  char *hist_num_buckets_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(hist_num_buckets_str != NULL);
+  CPRT_ATOI(hist_num_buckets_str, hist_num_buckets);
+
+  char *hist_ns_per_bucket_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  ASSRT(hist_ns_per_bucket_str != NULL);
+  CPRT_ATOI(hist_ns_per_bucket_str, hist_ns_per_bucket);
+
+  ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  free(work_str);
+  if (hist_num_buckets > 0) { ASSRT(hist_ns_per_bucket > 0); }
+
+  /* Parse the offload option: "num_workers,ring_slots[,first_cpu[,batch_size]]". */
+  work_str = CPRT_STRDUP(o_offload);
+  char *num_workers_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(num_workers_str != NULL);
+  CPRT_ATOI(num_workers_str, num_workers);
+
+  char *worker_ring_slots_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  ASSRT(worker_ring_slots_str != NULL);
+  CPRT_ATOI(worker_ring_slots_str, worker_ring_slots);
+
+  char *worker_first_cpu_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (worker_first_cpu_str != NULL) {
+    CPRT_ATOI(worker_first_cpu_str, worker_first_cpu);
+
+    char *worker_batch_size_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+    if (worker_batch_size_str != NULL) {
+      CPRT_ATOI(worker_batch_size_str, worker_batch_size);
+      ASSRT(worker_batch_size > 0);
+      ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    }
+  }
+  free(work_str);
+  if (num_workers > 0) {
+    /* Power of 2. */
+    ASSRT(worker_ring_slots > 0 && (worker_ring_slots & (worker_ring_slots - 1)) == 0);
+  }
+  if (o_zero_copy && num_workers == 0) {
+    usage("Error, -Z requires -O\n");
+  }
+
+  /* Parse the conflation option: "num_keys[,cpu]". */
+  work_str = CPRT_STRDUP(o_conflate);
+  char *conflate_num_keys_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(conflate_num_keys_str != NULL);
+  CPRT_ATOI(conflate_num_keys_str, conflate_num_keys);
+
+  char *conflate_cpu_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (conflate_cpu_str != NULL) {
+    CPRT_ATOI(conflate_cpu_str, conflate_cpu);
+    ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  }
+  free(work_str);
+  if (conflate_num_keys > 0 && num_workers > 0) {
+    usage("Error, -C and -O are mutually exclusive\n");
+  }
+
+  /* Parse the XSP option: "num_xsps[,first_cpu]". */
+  work_str = CPRT_STRDUP(o_xsps);
+  char *num_xsps_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(num_xsps_str != NULL);
+  CPRT_ATOI(num_xsps_str, num_xsps);
+
+  char *xsp_first_cpu_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (xsp_first_cpu_str != NULL) {
+    CPRT_ATOI(xsp_first_cpu_str, xsp_first_cpu);
+    ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  }
+  free(work_str);
+  /* The worker and conflation rings are single-producer. */
+  if (num_xsps > 0 && (num_workers > 0 || conflate_num_keys > 0)) {
+    usage("Error, -X can't be combined with -O or -C\n");
+  }
+  /* Per-XSP statistics depend on callbacks being on the XSP threads. */
+  if (num_xsps > 0 && o_evq_sample_ms > 0) {
+    usage("Error, -X and -Q are mutually exclusive\n");
+  }
+
+  /* The transport is chosen by the publisher; the subscriber checks it. */
+  if (strlen(o_transport) == 0) {
+    transport_source_prefix = NULL;
+  }
+  else if (strcmp(o_transport, "lbtrm") == 0) {
+    transport_source_prefix = "LBTRM:";
+  }
+  else if (strcmp(o_transport, "lbtru") == 0) {
+    transport_source_prefix = "LBTRU:";
+  }
+  else if (strcmp(o_transport, "tcp") == 0) {
+    transport_source_prefix = "TCP:";
+  }
+  else if (strcmp(o_transport, "lbtipc") == 0) {
+    transport_source_prefix = "LBT-IPC:";
+  }
+  else if (strcmp(o_transport, "lbtsmx") == 0) {
+    transport_source_prefix = "LBT-SMX:";
+  }
+  else {
+    usage("Error, -P value must be lbtrm, lbtru, tcp, lbtipc, or lbtsmx\n");
+  }
+
+  /* Parse the round-trip option: "rtt_mode[,pong_topic]". */
+  if (strlen(o_rtt) > 0) {
+    work_str = CPRT_STRDUP(o_rtt);
+    char *rtt_mode_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+    ASSRT(rtt_mode_str != NULL);
+    if (strcmp(rtt_mode_str, "req") == 0) {
+      rtt_mode = RTT_REQ;
+      ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    }
+    else if (strcmp(rtt_mode_str, "pong") == 0) {
+      rtt_mode = RTT_PONG;
+      char *rtt_pong_topic_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+      ASSRT(rtt_pong_topic_str != NULL);
+      rtt_pong_topic = CPRT_STRDUP(rtt_pong_topic_str);
+      ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    }
+    else {
+      usage("Error, -R mode must be 'req' or 'pong'\n");
+    }
+    free(work_str);
+
+    /* The reply is sent after the message is processed. */
+    if (num_workers > 0 || conflate_num_keys > 0) {
+      usage("Error, -R can't be combined with -O or -C\n");
+    }
+  }
+
+  /* Parse the explicit ack option: "ack_msgs[,ack_us]". */
+  work_str = CPRT_STRDUP(o_ack);
+  char *ack_batch_msgs_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+  ASSRT(ack_batch_msgs_str != NULL);
+  CPRT_ATOI(ack_batch_msgs_str, ack_batch_msgs);
+
+  char *ack_interval_us_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+  if (ack_interval_us_str != NULL) {
+    CPRT_ATOI(ack_interval_us_str, ack_interval_us);
+    ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+  }
+  free(work_str);
+  ASSRT(ack_batch_msgs >= 0 && ack_interval_us >= 0);
+  do_explicit_ack = (ack_batch_msgs > 0 || ack_interval_us > 0);
+
+  /* Parse the workload option: "workload,param". */
+  if (o_spin_cnt > 0) {
+    ASSRT(strlen(o_workload) == 0);  /* -s and -W are mutually exclusive. */
+    free(o_workload);
+    o_workload = (char *)malloc(32);
+    ASSRT(o_workload != NULL);
+    snprintf(o_workload, 32, "spin,%d", o_spin_cnt);
+  }
+  if (strlen(o_workload) > 0) {
+    work_str = CPRT_STRDUP(o_workload);
+    char *workload_type_str = CPRT_STRTOK(work_str, ",", &strtok_context);
+    ASSRT(workload_type_str != NULL);
+    if (strcmp(workload_type_str, "spin") == 0) {
+      workload_type = WORKLOAD_SPIN;
+    }
+    else if (strcmp(workload_type_str, "parse") == 0) {
+      workload_type = WORKLOAD_PARSE;
+    }
+    else if (strcmp(workload_type_str, "book") == 0) {
+      workload_type = WORKLOAD_BOOK;
+    }
+    else if (strcmp(workload_type_str, "touch") == 0) {
+      workload_type = WORKLOAD_TOUCH;
+    }
+    else {
+      usage("Error, -W workload must be 'spin', 'parse', 'book', or 'touch'\n");
+    }
+
+    char *workload_param_str = CPRT_STRTOK(NULL, ",", &strtok_context);
+    ASSRT(workload_param_str != NULL);
+    CPRT_ATOI(workload_param_str, workload_param);
+    ASSRT(workload_param > 0);
+
+    ASSRT(CPRT_STRTOK(NULL, ",", &strtok_context) == NULL);
+    free(work_str);
+  }
+
   if (strlen(o_persist) == 0) {
     app_name = "um_perf";
   }
@@ -128,57 +385,1703 @@ void get_my_opts(int argc, char **argv)
 }  /* get_my_opts */
 
 
-/* This "counter" is made global to force the optimizer to update it. */
-int global_counter;
+/* Histogram. Unlike the publisher, the subscriber keeps more than one,
+ * so each histogram's state is in a structure. */
+struct hist_s {
+  char *name;
+  int *buckets;
+  int num_buckets;
+  int units_per_bucket;
+  uint64_t min_sample;
+  uint64_t max_sample;
+  uint64_t overflows;  /* Number of values at or above the last bucket. */
+  uint64_t num_samples;
+  uint64_t sample_sum;
+};
+typedef struct hist_s hist_t;
+
+void hist_init(hist_t *hist)
+{
+  /* Re-initialize the data. */
+  hist->min_sample = (uint64_t)-1;
+  hist->max_sample = 0;
+  hist->overflows = 0;
+  hist->num_samples = 0;
+  hist->sample_sum = 0;
+
+  /* Init histogram (also makes sure it is mapped to physical memory. */
+  int i;
+  for (i = 0; i < hist->num_buckets; i++) {
+    hist->buckets[i] = 0;
+  }
+}  /* hist_init */
+
+void hist_create(hist_t *hist, char *name, int num_buckets, int units_per_bucket)
+{
+  hist->name = name;
+  hist->num_buckets = num_buckets;
+  hist->units_per_bucket = units_per_bucket;
+  hist->buckets = (int *)malloc(num_buckets * sizeof(int));
+  ASSRT(hist->buckets != NULL);
+
+  hist_init(hist);
+}  /* hist_create */
+
+/* Samples are 64-bit, so that long latencies (e.g. seconds of recovery)
+ * are counted as overflows instead of wrapping negative. */
+void hist_input(hist_t *hist, uint64_t in_sample)
+{
+  ASSRT(hist->buckets != NULL);
+
+  hist->num_samples++;
+  hist->sample_sum += in_sample;
+
+  if (in_sample > hist->max_sample) {
+    hist->max_sample = in_sample;
+  }
+  if (in_sample < hist->min_sample) {
+    hist->min_sample = in_sample;
+  }
+
+  uint64_t bucket = in_sample / (uint64_t)hist->units_per_bucket;
+  if (bucket >= (uint64_t)hist->num_buckets) {
+    hist->overflows++;
+  }
+  else {
+    hist->buckets[bucket]++;
+  }
+}  /* hist_input */
+
+void hist_print(hist_t *hist)
+{
+  int i;
+  printf("hist %s:\n", hist->name);
+  for (i = 0; i < hist->num_buckets; i++) {
+    printf("%d\n", hist->buckets[i]);
+  }
+  printf("hist=%s, num_buckets=%d, units_per_bucket=%d, hist_overflows=%"PRIu64", hist_min_sample=%"PRIu64", hist_max_sample=%"PRIu64",\n",
+      hist->name, hist->num_buckets, hist->units_per_bucket, hist->overflows,
+      (hist->num_samples == 0) ? 0 : hist->min_sample, hist->max_sample);
+  uint64_t average_sample = (hist->num_samples == 0) ?
+      0 : hist->sample_sum / hist->num_samples;
+  printf("hist_num_samples=%"PRIu64", average_sample=%"PRIu64",\n",
+      hist->num_samples, average_sample);
+}  /* hist_print */
+
+
+/* Recovery histograms (-H). */
+int do_histogram;
+hist_t recovered_latency_hist;  /* ns, send to receipt of recovered msgs. */
+hist_t gap_size_hist;  /* Messages per detected gap. */
+hist_t gap_recovery_hist;  /* ns, gap detection to receipt of recovered msgs. */
+
+
+/* Sequence tracking. Received sequence numbers are recorded in a sliding
+ * bitmap window; a number that slides out of the window without having been
+ * received is counted as lost. Used per source, for both UM sequence numbers
+ * and perf_msg->msg_num (each publisher numbers its own messages, so
+ * different or restarted publishers don't mix). A load-balanced publisher
+ * (FLAGS_LOAD_BALANCE) spreads one msg_num sequence over its sources, so
+ * those messages are tracked across all sources instead, which verifies
+ * that nothing went missing between the sources. */
+#define SEQ_WINDOW 65536  /* Bits; max reorder depth that is not loss. */
+#define SEQ_WORDS (SEQ_WINDOW / 64)
+#define SEQ_MAX_GAPS 16  /* Gap positions reported. */
+struct seq_gap_s {
+  uint64_t start;
+  uint64_t len;
+};
+struct seq_track_s {
+  int valid;
+  uint64_t base;  /* Oldest sequence number in the window. */
+  uint64_t next;  /* One past the highest sequence number received. */
+  uint64_t num_rcvd;
+  uint64_t num_lost;
+  uint64_t num_dups;
+  uint64_t num_reordered;
+  uint64_t max_reorder_depth;
+  uint64_t num_too_old;  /* Behind the window: late or duplicate. */
+  uint64_t num_gaps;
+  struct seq_gap_s open_gap;  /* len==0 if none. */
+  struct seq_gap_s gaps[SEQ_MAX_GAPS];
+  uint64_t bitmap[SEQ_WORDS];
+};
+typedef struct seq_track_s seq_track_t;
+
+void seq_track_init(seq_track_t *st)
+{
+  memset(st, 0, sizeof(*st));
+}  /* seq_track_init */
+
+void seq_track_lost(seq_track_t *st, uint64_t start, uint64_t len)
+{
+  st->num_lost += len;
+  if (st->open_gap.len > 0 && st->open_gap.start + st->open_gap.len == start) {
+    st->open_gap.len += len;  /* Extend the current gap. */
+    return;
+  }
+  if (st->open_gap.len > 0 && st->num_gaps <= SEQ_MAX_GAPS) {
+    st->gaps[st->num_gaps - 1] = st->open_gap;
+  }
+  st->num_gaps++;
+  st->open_gap.start = start;
+  st->open_gap.len = len;
+}  /* seq_track_lost */
+
+/* Slide the window forward by one. */
+void seq_track_retire(seq_track_t *st)
+{
+  uint64_t *word = &st->bitmap[(st->base / 64) % SEQ_WORDS];
+  uint64_t bit = 1ull << (st->base % 64);
+
+  if ((*word & bit) == 0) {
+    seq_track_lost(st, st->base, 1);
+  }
+  *word &= ~bit;
+  st->base++;
+}  /* seq_track_retire */
+
+void seq_track_input(seq_track_t *st, uint64_t seq)
+{
+  if (! st->valid) {
+    st->base = seq;
+    st->next = seq;
+    st->valid = 1;
+  }
+  if (seq < st->base) {
+    st->num_too_old++;
+    return;
+  }
+
+  while (seq >= st->base + SEQ_WINDOW) {
+    if (st->base >= st->next) {
+      /* Nothing received in the window; skip to the new message. */
+      uint64_t new_base = seq - SEQ_WINDOW + 1;
+      seq_track_lost(st, st->base, new_base - st->base);
+      st->base = new_base;
+      break;
+    }
+    seq_track_retire(st);
+  }
+
+  uint64_t *word = &st->bitmap[(seq / 64) % SEQ_WORDS];
+  uint64_t bit = 1ull << (seq % 64);
+  if ((*word & bit) != 0) {
+    st->num_dups++;
+    return;
+  }
+  *word |= bit;
+  st->num_rcvd++;
+
+  if (seq < st->next) {  /* Arrived after a higher sequence number. */
+    uint64_t depth = st->next - seq;
+    st->num_reordered++;
+    if (depth > st->max_reorder_depth) st->max_reorder_depth = depth;
+  }
+  else {
+    st->next = seq + 1;
+  }
+}  /* seq_track_input */
+
+/* Account for everything still in the window (e.g. at EOS). */
+void seq_track_finish(seq_track_t *st)
+{
+  while (st->base < st->next) {
+    seq_track_retire(st);
+  }
+  if (st->open_gap.len > 0 && st->num_gaps <= SEQ_MAX_GAPS) {
+    st->gaps[st->num_gaps - 1] = st->open_gap;
+  }
+  st->open_gap.len = 0;
+}  /* seq_track_finish */
+
+void seq_track_print(seq_track_t *st, const char *label, const char *topic_name, const char *source)
+{
+  int i;
+
+  printf("rcv event EOS %s, '%s', %s, num_rcvd=%"PRIu64", num_lost=%"PRIu64", num_gaps=%"PRIu64", num_dups=%"PRIu64", num_reordered=%"PRIu64", max_reorder_depth=%"PRIu64", num_too_old=%"PRIu64", ",
+      label, topic_name, source, st->num_rcvd, st->num_lost, st->num_gaps,
+      st->num_dups, st->num_reordered, st->max_reorder_depth, st->num_too_old);
+  if (st->num_gaps > 0) {
+    printf("gaps=");
+    for (i = 0; i < st->num_gaps && i < SEQ_MAX_GAPS; i++) {
+      printf("%"PRIu64"+%"PRIu64"%s", st->gaps[i].start, st->gaps[i].len,
+          (i + 1 < st->num_gaps && i + 1 < SEQ_MAX_GAPS) ? ";" : "");
+    }
+    printf("%s, ", (st->num_gaps > SEQ_MAX_GAPS) ? ";..." : "");
+  }
+  printf("\n");
+}  /* seq_track_print */
+
+
+/* Receive statistics. Each source has its own (see src_state_s), and the
+ * per-source blocks are summed into an aggregate as each source ends. */
+struct rcv_stats_s {
+  uint64_t num_rcv_msgs;
+  uint64_t num_rx_msgs;
+  uint64_t num_unrec_loss;
+  uint64_t num_short_msgs;  /* Too small to be a perf_msg_t; ignored. */
+  uint64_t min_latency;
+  uint64_t max_latency;
+  uint64_t sum_latencies;  /* For calculating average latencies. */
+  uint64_t num_timestamps; /* For calculating average latencies. */
+  /* Late join recovery (messages retransmitted by the Store or source). */
+  struct timespec bos_ts;
+  struct timespec first_recovered_ts;
+  struct timespec last_recovered_ts;
+  struct timespec caught_up_ts;
+  uint64_t num_recovered_msgs;
+  uint64_t num_live_during_recovery;
+  uint64_t min_live_during_recovery_latency;
+  uint64_t max_live_during_recovery_latency;
+  uint64_t sum_live_during_recovery_latencies;
+  /* Gap tracking by UM sequence number. Overlapping gaps are merged, and
+   * the detection time of the first one is kept. */
+  int seq_valid;
+  lbm_uint_t expected_seq;
+  int gap_outstanding;
+  lbm_uint_t gap_end_seq;  /* One past the last missing seq. */
+  struct timespec gap_detect_ts;
+  uint64_t num_gaps;
+  uint64_t max_gap_size;
+  /* Explicit acks (-A). */
+  uint64_t num_acks;
+  uint64_t num_ack_fails;
+};
+typedef struct rcv_stats_s rcv_stats_t;
+
+void rcv_stats_init(rcv_stats_t *stats)
+{
+  memset(stats, 0, sizeof(*stats));
+  stats->min_latency = (uint64_t)-1;  /* max int */
+  stats->min_live_during_recovery_latency = (uint64_t)-1;  /* max int */
+}  /* rcv_stats_init */
+
+/* Nanoseconds from ts2 to ts1; negative if ts1 is earlier. */
+int64_t ts_cmp(struct timespec *ts1, struct timespec *ts2)
+{
+  uint64_t diff_ns;
+  CPRT_DIFF_TS(diff_ns, (*ts1), (*ts2));
+  return (int64_t)diff_ns;
+}  /* ts_cmp */
+
+/* Add one source's statistics into the aggregate. Recovery times are
+ * combined as the earliest start and the latest end; the aggregate's
+ * bos_ts is that of the first source. */
+void rcv_stats_add(rcv_stats_t *sum, rcv_stats_t *stats)
+{
+  sum->num_rcv_msgs += stats->num_rcv_msgs;
+  sum->num_rx_msgs += stats->num_rx_msgs;
+  sum->num_unrec_loss += stats->num_unrec_loss;
+  sum->num_short_msgs += stats->num_short_msgs;
+  if (stats->min_latency < sum->min_latency) sum->min_latency = stats->min_latency;
+  if (stats->max_latency > sum->max_latency) sum->max_latency = stats->max_latency;
+  sum->sum_latencies += stats->sum_latencies;
+  sum->num_timestamps += stats->num_timestamps;
+
+  if (stats->num_recovered_msgs > 0) {
+    if (sum->num_recovered_msgs == 0 ||
+        ts_cmp(&stats->first_recovered_ts, &sum->first_recovered_ts) < 0) {
+      sum->first_recovered_ts = stats->first_recovered_ts;
+    }
+    if (sum->num_recovered_msgs == 0 ||
+        ts_cmp(&stats->last_recovered_ts, &sum->last_recovered_ts) > 0) {
+      sum->last_recovered_ts = stats->last_recovered_ts;
+    }
+    sum->num_recovered_msgs += stats->num_recovered_msgs;
+  }
+  if (stats->num_live_during_recovery > 0) {
+    if (sum->num_live_during_recovery == 0 ||
+        ts_cmp(&stats->caught_up_ts, &sum->caught_up_ts) > 0) {
+      sum->caught_up_ts = stats->caught_up_ts;
+    }
+    if (stats->min_live_during_recovery_latency < sum->min_live_during_recovery_latency) {
+      sum->min_live_during_recovery_latency = stats->min_live_during_recovery_latency;
+    }
+    if (stats->max_live_during_recovery_latency > sum->max_live_during_recovery_latency) {
+      sum->max_live_during_recovery_latency = stats->max_live_during_recovery_latency;
+    }
+    sum->sum_live_during_recovery_latencies += stats->sum_live_during_recovery_latencies;
+    sum->num_live_during_recovery += stats->num_live_during_recovery;
+  }
+
+  sum->num_gaps += stats->num_gaps;
+  if (stats->max_gap_size > sum->max_gap_size) sum->max_gap_size = stats->max_gap_size;
+  sum->num_acks += stats->num_acks;
+  sum->num_ack_fails += stats->num_ack_fails;
+}  /* rcv_stats_add */
+
+void rcv_stats_print(rcv_stats_t *stats, const char *topic_name, const char *source)
+{
+  if (stats->num_timestamps > 0) {
+    printf("rcv event EOS, '%s', %s, num_rcv_msgs=%"PRIu64", num_rx_msgs=%"PRIu64", num_unrec_loss=%"PRIu64", min_latency=%"PRIu64", max_latency=%"PRIu64", average latency=%"PRIu64", \n",
+        topic_name, source, stats->num_rcv_msgs, stats->num_rx_msgs, stats->num_unrec_loss,
+        stats->min_latency, stats->max_latency, stats->sum_latencies / stats->num_timestamps);
+  } else {
+    printf("rcv event EOS, '%s', %s, num_rcv_msgs=%"PRIu64", num_rx_msgs=%"PRIu64", num_unrec_loss=%"PRIu64",\n",
+        topic_name, source, stats->num_rcv_msgs, stats->num_rx_msgs, stats->num_unrec_loss);
+  }
+  if (stats->num_short_msgs > 0) {
+    printf("rcv event EOS, WARNING: '%s', %s, num_short_msgs=%"PRIu64", \n",
+        topic_name, source, stats->num_short_msgs);
+  }
+
+  if (stats->num_recovered_msgs > 0) {
+    uint64_t recovery_ns;  /* BOS to last recovered message. */
+    uint64_t recovery_burst_ns;  /* First to last recovered message. */
+    double recovery_rate;
+    CPRT_DIFF_TS(recovery_ns, stats->last_recovered_ts, stats->bos_ts);
+    CPRT_DIFF_TS(recovery_burst_ns, stats->last_recovered_ts, stats->first_recovered_ts);
+    recovery_rate = (recovery_burst_ns == 0) ? 0.0 :
+        (double)(stats->num_recovered_msgs - 1) * 1000000000.0 / (double)recovery_burst_ns;
+    printf("rcv event EOS recovery, '%s', %s, num_recovered_msgs=%"PRIu64", recovery_ns=%"PRIu64", recovery_rate=%f, ",
+        topic_name, source, stats->num_recovered_msgs, recovery_ns, recovery_rate);
+    if (stats->num_live_during_recovery > 0) {
+      uint64_t catch_up_ns;  /* BOS to last live message sent during recovery. */
+      CPRT_DIFF_TS(catch_up_ns, stats->caught_up_ts, stats->bos_ts);
+      printf("catch_up_ns=%"PRIu64", num_live_during_recovery=%"PRIu64", min_latency=%"PRIu64", max_latency=%"PRIu64", average latency=%"PRIu64", \n",
+          catch_up_ns, stats->num_live_during_recovery,
+          stats->min_live_during_recovery_latency, stats->max_live_during_recovery_latency,
+          stats->sum_live_during_recovery_latencies / stats->num_live_during_recovery);
+    } else {
+      printf("\n");
+    }
+  }
+
+  if (stats->num_gaps > 0) {
+    printf("rcv event EOS gaps, '%s', %s, num_gaps=%"PRIu64", max_gap_size=%"PRIu64", \n",
+        topic_name, source, stats->num_gaps, stats->max_gap_size);
+  }
+
+  if (stats->num_acks > 0 || stats->num_ack_fails > 0) {
+    printf("rcv event EOS acks, '%s', %s, num_acks=%"PRIu64", msgs_per_ack=%f, num_ack_fails=%"PRIu64", \n",
+        topic_name, source, stats->num_acks,
+        (stats->num_acks == 0) ? 0.0 : (double)stats->num_rcv_msgs / (double)stats->num_acks,
+        stats->num_ack_fails);
+  }
+}  /* rcv_stats_print */
+
+
+/* Memory that is written by different threads is allocated on cache line
+ * boundaries to avoid false sharing. */
+#define CACHE_LINE_SIZE 64
+
+void *cache_aligned_alloc(size_t size)
+{
+  void *ptr;
+#if defined(_WIN32)
+  ptr = _aligned_malloc(size, CACHE_LINE_SIZE);
+  ASSRT(ptr != NULL);
+#else
+  ASSRT(posix_memalign(&ptr, CACHE_LINE_SIZE, size) == 0);
+#endif
+  return ptr;
+}  /* cache_aligned_alloc */
+
+void cache_aligned_free(void *ptr)
+{
+#if defined(_WIN32)
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}  /* cache_aligned_free */
+
+
+/* Per-source state, created by the receiver's source notification callback
+ * and passed to rcv_callback() as msg->source_clientd. It is cache aligned,
+ * with the frequently-updated statistics first, so that sources never share
+ * a cache line. */
+struct src_state_s {
+  rcv_stats_t stats;
+  uint64_t ext_seq;  /* UM sequence number extended to 64 bits. */
+  char *topic_name;
+  int worker_index;  /* With -O. */
+  seq_track_t seq_track;
+  seq_track_t msg_num_track;  /* Without FLAGS_LOAD_BALANCE. */
+  int ack_pending_msgs;  /* Received since the last explicit ack. */
+  /* One ack handle is extracted per batch, from its first message, and is
+   * sent with the sequence number of the latest message. Whoever sends it
+   * (rcv_callback() or ack_timer_thread()) first swaps it to NULL. */
+  lbm_ume_rcv_ack_t *ack;
+  lbm_uint_t ack_sqn;  /* Latest received sequence number. */
+  uint64_t ack_pending_ns;  /* Receipt of the batch's first message. */
+  uint64_t num_timer_acks;  /* Counted by ack_timer_thread(). */
+  uint64_t num_timer_ack_fails;
+  struct src_state_s *ack_next;  /* In ack_srcs. */
+};
+typedef struct src_state_s src_state_t;
+
+/* Sources with ack_interval_us, for ack_timer_thread(). */
+src_state_t *ack_srcs;
+CPRT_MUTEX_T ack_srcs_lock;
+
+/* Across all sources. */
+rcv_stats_t all_stats;
+seq_track_t msg_num_track;  /* By msg_num, with FLAGS_LOAD_BALANCE. */
+int num_active_srcs;
+int next_worker;  /* Round-robin assignment of sources to workers (-O). */
+
+
+void *src_create_cb(const char *source_name, void *clientd)
+{
+  src_state_t *src_state = (src_state_t *)cache_aligned_alloc(sizeof(src_state_t));
+
+  rcv_stats_init(&src_state->stats);
+  src_state->ext_seq = 0;
+  src_state->topic_name = (char *)clientd;
+  src_state->worker_index = 0;
+  if (num_workers > 0) {
+    src_state->worker_index = next_worker;
+    next_worker = (next_worker + 1) % num_workers;
+  }
+  seq_track_init(&src_state->seq_track);
+  seq_track_init(&src_state->msg_num_track);
+  src_state->ack_pending_msgs = 0;
+  src_state->ack = NULL;
+  src_state->ack_sqn = 0;
+  src_state->ack_pending_ns = 0;
+  src_state->num_timer_acks = 0;
+  src_state->num_timer_ack_fails = 0;
+  if (ack_interval_us > 0) {
+    CPRT_MUTEX_LOCK(ack_srcs_lock);
+    src_state->ack_next = ack_srcs;
+    ack_srcs = src_state;
+    CPRT_MUTEX_UNLOCK(ack_srcs_lock);
+  }
+
+  return src_state;
+}  /* src_create_cb */
+
+int src_delete_cb(const char *source_name, void *clientd, void *source_clientd)
+{
+  src_state_t *src_state = (src_state_t *)source_clientd;
+
+  if (ack_interval_us > 0) {
+    src_state_t **prev;
+    CPRT_MUTEX_LOCK(ack_srcs_lock);
+    for (prev = &ack_srcs; *prev != src_state; prev = &(*prev)->ack_next) {
+    }
+    *prev = src_state->ack_next;
+    CPRT_MUTEX_UNLOCK(ack_srcs_lock);
+  }
+  if (src_state->ack != NULL) {
+    E(lbm_ume_ack_delete(src_state->ack));
+  }
+  cache_aligned_free(source_clientd);
+
+  return 0;
+}  /* src_delete_cb */
+
+
+/* Receiver workload (-W), emulating per-message application work. Each
+ * thread that runs a workload has its own state. */
+#define BOOK_PAYLOAD_SIZE 40
+/* Order book entry, one cache line. The message payload is copied in. */
+struct book_entry_s {
+  uint64_t key;  /* 0 = empty; keys are stored +1. */
+  uint64_t num_updates;
+  uint64_t last_msg_num;
+  char payload[BOOK_PAYLOAD_SIZE];
+};
+#define TOUCH_LINES_PER_MSG 4
+struct workload_s {
+  int spin_counter;
+  struct book_entry_s *book_table;
+  uint64_t book_table_mask;  /* Table size (power of 2) minus 1. */
+  char *touch_buf;
+  uint64_t touch_num_lines;
+  uint64_t touch_rand;  /* xorshift state. */
+  /* Results are accumulated here so the optimizer can't discard the work. */
+  uint64_t sink;
+};
+typedef struct workload_s workload_t;
+
+/* Workload for the context thread (when not using worker threads). */
+workload_t rcv_workload;
+
+void workload_init(workload_t *wl)
+{
+  uint64_t i;
+
+  memset(wl, 0, sizeof(*wl));
+  wl->touch_rand = 1;
+
+  if (workload_type == WORKLOAD_BOOK) {
+    /* Keep the load factor at or below 50%. */
+    uint64_t table_size = 1;
+    while (table_size < 2 * (uint64_t)workload_param) table_size <<= 1;
+    wl->book_table = (struct book_entry_s *)malloc(table_size * sizeof(struct book_entry_s));
+    ASSRT(wl->book_table != NULL);
+    memset(wl->book_table, 0, table_size * sizeof(struct book_entry_s));
+    wl->book_table_mask = table_size - 1;
+  }
+  else if (workload_type == WORKLOAD_TOUCH) {
+    wl->touch_num_lines = (uint64_t)workload_param / 64;
+    ASSRT(wl->touch_num_lines > 0);
+    wl->touch_buf = (char *)malloc(wl->touch_num_lines * 64);
+    ASSRT(wl->touch_buf != NULL);
+    for (i = 0; i < wl->touch_num_lines * 64; i++) {
+      wl->touch_buf[i] = (char)i;  /* Map it to physical memory. */
+    }
+  }
+}  /* workload_init */
+
+/* Do the per-message work. "key" is the publisher's message number. */
+void workload_run(workload_t *wl, const char *data, size_t len, uint64_t key)
+{
+  switch (workload_type) {
+  case WORKLOAD_SPIN:
+    /* This "counter" loop is to introduce short delays into the receiver. */
+    for (wl->spin_counter = 0; wl->spin_counter < workload_param; wl->spin_counter++) {
+    }
+    break;
+
+  case WORKLOAD_PARSE:
+  {
+    /* Fields are big-endian 64-bit integers following perf_msg_t. */
+    const unsigned char *field = (const unsigned char *)data + sizeof(perf_msg_t);
+    int num_fields = (len > sizeof(perf_msg_t)) ?
+        (int)((len - sizeof(perf_msg_t)) / 8) : 0;
+    int i, b;
+    if (num_fields > workload_param) num_fields = workload_param;
+    for (i = 0; i < num_fields; i++) {
+      uint64_t value = 0;
+      for (b = 0; b < 8; b++) {
+        value = (value << 8) | field[b];
+      }
+      wl->sink += value;
+      field += 8;
+    }
+    break;
+  }
+
+  case WORKLOAD_BOOK:
+  {
+    struct book_entry_s *book_table = wl->book_table;
+    uint64_t book_key = (key % (uint64_t)workload_param) + 1;
+    uint64_t bucket = (book_key * 0x9E3779B97F4A7C15ull) & wl->book_table_mask;
+    size_t copy_len = (len < BOOK_PAYLOAD_SIZE) ? len : BOOK_PAYLOAD_SIZE;
+    while (book_table[bucket].key != book_key && book_table[bucket].key != 0) {
+      bucket = (bucket + 1) & wl->book_table_mask;  /* Linear probe. */
+    }
+    book_table[bucket].key = book_key;
+    book_table[bucket].num_updates++;
+    book_table[bucket].last_msg_num = key;
+    memcpy(book_table[bucket].payload, data, copy_len);
+    wl->sink += book_table[bucket].num_updates;
+    break;
+  }
+
+  case WORKLOAD_TOUCH:
+  {
+    int i;
+    for (i = 0; i < TOUCH_LINES_PER_MSG; i++) {
+      wl->touch_rand ^= wl->touch_rand << 13;
+      wl->touch_rand ^= wl->touch_rand >> 7;
+      wl->touch_rand ^= wl->touch_rand << 17;
+      char *line = &wl->touch_buf[(wl->touch_rand % wl->touch_num_lines) * 64];
+      line[0]++;  /* Read-modify-write dirties the line. */
+      wl->sink += line[0];
+    }
+    break;
+  }
+  }  /* switch workload_type */
+}  /* workload_run */
+
+/* Measure the workload's cost per message before any messages arrive. */
+void workload_calibrate(workload_t *wl)
+{
+  char msg_buf[700];  /* The tests' message size. */
+  struct timespec start_ts, end_ts;
+  uint64_t duration_ns;
+  uint64_t i;
+  uint64_t num_loops = 1000000;
+
+  memset(msg_buf, 0x5a, sizeof(msg_buf));
+  /* Warm up, then time. */
+  for (i = 0; i < num_loops / 10; i++) {
+    workload_run(wl, msg_buf, sizeof(msg_buf), i);
+  }
+  CPRT_GETTIME(&start_ts);
+  for (i = 0; i < num_loops; i++) {
+    workload_run(wl, msg_buf, sizeof(msg_buf), i);
+  }
+  CPRT_GETTIME(&end_ts);
+  CPRT_DIFF_TS(duration_ns, end_ts, start_ts);
+
+  printf("workload=%s, ns_per_msg=%f, max_rate=%f, \n", o_workload,
+      (double)duration_ns / (double)num_loops,
+      (duration_ns == 0) ? 0.0 : (double)num_loops * 1000000000.0 / (double)duration_ns);
+}  /* workload_calibrate */
+
+
+/* Worker threads (-O). The context thread hands each message to a worker
+ * over a single-producer/single-consumer ring, and the worker runs the
+ * workload. The message is either copied into the ring slot, or (with -Z)
+ * retained by UM and passed by reference, in which case the worker deletes
+ * it after processing. Workers process up to worker_batch_size messages at
+ * a time. Each source is assigned to one worker, preserving per-source
+ * order. Each thread only resets the statistics it writes; at BOS, the
+ * context thread bumps reset_gen, and the worker resets its own when it
+ * sees the new generation. */
+#define WORKER_SLOT_DATA_SIZE 2040  /* Larger messages are truncated. */
+struct worker_slot_s {
+  struct timespec enq_ts;
+  uint64_t msg_num;
+  lbm_msg_t *msg;  /* Retained message (-Z), or NULL if copied. */
+  size_t len;
+  char data[WORKER_SLOT_DATA_SIZE];  /* Not allocated with -Z. */
+};
+struct worker_s {
+  /* Read-only after creation. */
+  char *ring;
+  uint64_t ring_mask;  /* Number of slots (power of 2) minus 1. */
+  size_t slot_size;
+  int index;
+  int cpu;
+  CPRT_THREAD_T thread_id;
+  char pad1[CACHE_LINE_SIZE];
+  /* Written by the context thread. */
+  uint64_t head;  /* Next slot to fill. */
+  uint64_t num_enqueued;
+  uint64_t num_full;  /* Times the context thread waited for a free slot. */
+  uint64_t num_truncated;
+  uint64_t max_occupancy;
+  uint64_t sum_occupancy;  /* Sampled at each enqueue. */
+  uint64_t retained_bytes_in;
+  uint64_t max_retained_bytes;
+  uint64_t reset_gen;  /* Bumped to have the worker reset its statistics. */
+  char pad2[CACHE_LINE_SIZE];
+  /* Written by the worker thread. */
+  uint64_t tail;  /* Next slot to process. */
+  uint64_t retained_bytes_out;  /* Deleted. */
+  uint64_t done_reset_gen;
+  uint64_t num_msgs;
+  uint64_t min_handoff_ns;
+  uint64_t max_handoff_ns;
+  uint64_t sum_handoff_ns;
+  uint64_t num_batches;
+  uint64_t min_batch_ns;
+  uint64_t max_batch_ns;
+  uint64_t sum_batch_ns;
+  hist_t handoff_hist;
+  hist_t batch_hist;
+  workload_t workload;
+  char pad3[CACHE_LINE_SIZE];
+};
+typedef struct worker_s worker_t;
+
+worker_t *workers;
+
+struct worker_slot_s *worker_slot(worker_t *worker, uint64_t index)
+{
+  return (struct worker_slot_s *)(worker->ring +
+      (index & worker->ring_mask) * worker->slot_size);
+}  /* worker_slot */
+
+/* Statistics written by the context thread. */
+void worker_enq_stats_init(worker_t *worker)
+{
+  worker->num_enqueued = 0;
+  worker->num_full = 0;
+  worker->num_truncated = 0;
+  worker->max_occupancy = 0;
+  worker->sum_occupancy = 0;
+  worker->max_retained_bytes = 0;
+}  /* worker_enq_stats_init */
+
+/* Statistics written by the worker thread. */
+void worker_stats_init(worker_t *worker)
+{
+  worker->num_msgs = 0;
+  worker->min_handoff_ns = (uint64_t)-1;  /* max int */
+  worker->max_handoff_ns = 0;
+  worker->sum_handoff_ns = 0;
+  worker->num_batches = 0;
+  worker->min_batch_ns = (uint64_t)-1;  /* max int */
+  worker->max_batch_ns = 0;
+  worker->sum_batch_ns = 0;
+  if (do_histogram) {
+    hist_init(&worker->handoff_hist);
+    hist_init(&worker->batch_hist);
+  }
+}  /* worker_stats_init */
+
+/* Called by the context thread at BOS. */
+void worker_stats_reset(worker_t *worker)
+{
+  worker_enq_stats_init(worker);
+  __atomic_store_n(&worker->reset_gen, worker->reset_gen + 1, __ATOMIC_RELEASE);
+}  /* worker_stats_reset */
+
+/* Called by the context thread, from the receiver callback. */
+void worker_enqueue(worker_t *worker, lbm_msg_t *msg, uint64_t msg_num)
+{
+  uint64_t head = worker->head;
+  uint64_t occupancy = head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE);
+
+  if (occupancy > worker->ring_mask) {
+    /* Full; wait for the worker. */
+    worker->num_full++;
+    do {
+      occupancy = head - __atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE);
+    } while (occupancy > worker->ring_mask);
+  }
+  worker->num_enqueued++;
+  worker->sum_occupancy += occupancy;
+  if (occupancy > worker->max_occupancy) worker->max_occupancy = occupancy;
+
+  struct worker_slot_s *slot = worker_slot(worker, head);
+  if (o_zero_copy) {
+    E(lbm_msg_retain(msg));
+    slot->msg = msg;
+    slot->len = msg->len;
+    worker->retained_bytes_in += msg->len;
+    uint64_t retained_bytes = worker->retained_bytes_in -
+        __atomic_load_n(&worker->retained_bytes_out, __ATOMIC_ACQUIRE);
+    if (retained_bytes > worker->max_retained_bytes) {
+      worker->max_retained_bytes = retained_bytes;
+    }
+  }
+  else {
+    size_t len = msg->len;
+    if (len > WORKER_SLOT_DATA_SIZE) {
+      len = WORKER_SLOT_DATA_SIZE;
+      worker->num_truncated++;
+    }
+    memcpy(slot->data, msg->data, len);
+    slot->msg = NULL;
+    slot->len = len;
+  }
+  slot->msg_num = msg_num;
+  CPRT_GETTIME(&slot->enq_ts);
+
+  __atomic_store_n(&worker->head, head + 1, __ATOMIC_RELEASE);
+}  /* worker_enqueue */
+
+CPRT_THREAD_ENTRYPOINT worker_thread(void *in_arg)
+{
+  worker_t *worker = (worker_t *)in_arg;
+  struct timespec batch_start_ts;
+  struct timespec batch_end_ts;
+  uint64_t cpuset;
+  uint64_t i;
+
+  if (worker->cpu > -1) {
+    CPRT_CPU_ZERO(&cpuset);
+    CPRT_CPU_SET(worker->cpu, &cpuset);
+    cprt_set_affinity(cpuset);
+  }
+
+  while (1) {
+    uint64_t tail = worker->tail;
+    uint64_t batch = __atomic_load_n(&worker->head, __ATOMIC_ACQUIRE) - tail;
+    /* Checked after loading head, so a reset requested before a message
+     * was enqueued is done before that message is processed. */
+    uint64_t reset_gen = __atomic_load_n(&worker->reset_gen, __ATOMIC_ACQUIRE);
+    if (reset_gen != worker->done_reset_gen) {
+      worker_stats_init(worker);
+      __atomic_store_n(&worker->done_reset_gen, reset_gen, __ATOMIC_RELEASE);
+    }
+    if (batch == 0) {
+      continue;  /* Busy-poll. */
+    }
+    if (batch > (uint64_t)worker_batch_size) batch = worker_batch_size;
+
+    CPRT_GETTIME(&batch_start_ts);
+    for (i = 0; i < batch; i++) {
+      struct worker_slot_s *slot = worker_slot(worker, tail + i);
+
+      uint64_t handoff_ns;
+      CPRT_DIFF_TS(handoff_ns, batch_start_ts, slot->enq_ts);
+      if (handoff_ns < worker->min_handoff_ns) worker->min_handoff_ns = handoff_ns;
+      if (handoff_ns > worker->max_handoff_ns) worker->max_handoff_ns = handoff_ns;
+      worker->sum_handoff_ns += handoff_ns;
+      if (do_histogram) {
+        hist_input(&worker->handoff_hist, handoff_ns);
+      }
+
+      if (workload_type != WORKLOAD_NONE) {
+        workload_run(&worker->workload,
+            (slot->msg != NULL) ? slot->msg->data : slot->data,
+            slot->len, slot->msg_num);
+      }
+    }
+
+    /* Release the retained messages once the whole batch is processed. */
+    if (o_zero_copy) {
+      uint64_t deleted_bytes = 0;
+      for (i = 0; i < batch; i++) {
+        struct worker_slot_s *slot = worker_slot(worker, tail + i);
+        deleted_bytes += slot->len;
+        E(lbm_msg_delete(slot->msg));
+      }
+      __atomic_store_n(&worker->retained_bytes_out,
+          worker->retained_bytes_out + deleted_bytes, __ATOMIC_RELEASE);
+    }
+
+    uint64_t batch_ns;
+    CPRT_GETTIME(&batch_end_ts);
+    CPRT_DIFF_TS(batch_ns, batch_end_ts, batch_start_ts);
+    worker->num_msgs += batch;
+    worker->num_batches++;
+    if (batch_ns < worker->min_batch_ns) worker->min_batch_ns = batch_ns;
+    if (batch_ns > worker->max_batch_ns) worker->max_batch_ns = batch_ns;
+    worker->sum_batch_ns += batch_ns;
+    if (do_histogram) {
+      hist_input(&worker->batch_hist, batch_ns);
+    }
+
+    __atomic_store_n(&worker->tail, tail + batch, __ATOMIC_RELEASE);
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* worker_thread */
+
+void workers_create()
+{
+  int i;
+
+  workers = (worker_t *)cache_aligned_alloc(num_workers * sizeof(worker_t));
+  for (i = 0; i < num_workers; i++) {
+    worker_t *worker = &workers[i];
+    memset(worker, 0, sizeof(*worker));
+    /* Retained messages are passed by reference; no data area. */
+    worker->slot_size = o_zero_copy ?
+        offsetof(struct worker_slot_s, data) : sizeof(struct worker_slot_s);
+    worker->ring = (char *)cache_aligned_alloc(worker_ring_slots * worker->slot_size);
+    /* Map the ring to physical memory. */
+    memset(worker->ring, 0, worker_ring_slots * worker->slot_size);
+    worker->ring_mask = worker_ring_slots - 1;
+    worker->index = i;
+    worker->cpu = (worker_first_cpu > -1) ? (worker_first_cpu + i) : -1;
+    if (do_histogram) {
+      char *hist_name = (char *)malloc(32);
+      ASSRT(hist_name != NULL);
+      snprintf(hist_name, 32, "handoff_ns_worker_%d", i);
+      hist_create(&worker->handoff_hist, hist_name,
+          hist_num_buckets, hist_ns_per_bucket);
+      hist_name = (char *)malloc(32);
+      ASSRT(hist_name != NULL);
+      snprintf(hist_name, 32, "batch_ns_worker_%d", i);
+      hist_create(&worker->batch_hist, hist_name,
+          hist_num_buckets, hist_ns_per_bucket);
+    }
+    worker_enq_stats_init(worker);
+    worker_stats_init(worker);
+    workload_init(&worker->workload);
+
+    CPRT_THREAD_CREATE(worker->thread_id, worker_thread, worker);
+  }
+}  /* workers_create */
+
+/* Called by the context thread at the end of a test run. */
+void workers_print()
+{
+  int i;
+
+  for (i = 0; i < num_workers; i++) {
+    worker_t *worker = &workers[i];
+    /* Let the worker finish the messages already handed to it (and
+     * reset its statistics, if it got no messages). */
+    while (__atomic_load_n(&worker->tail, __ATOMIC_ACQUIRE) != worker->head ||
+        __atomic_load_n(&worker->done_reset_gen, __ATOMIC_ACQUIRE) != worker->reset_gen) {
+    }
+
+    printf("rcv event EOS worker, index=%d, cpu=%d, num_msgs=%"PRIu64", num_full=%"PRIu64", num_truncated=%"PRIu64", max_occupancy=%"PRIu64", average_occupancy=%f, ring_bytes=%"PRIu64", max_retained_bytes=%"PRIu64", ",
+        worker->index, worker->cpu, worker->num_msgs, worker->num_full,
+        worker->num_truncated, worker->max_occupancy,
+        (worker->num_enqueued == 0) ? 0.0 :
+        (double)worker->sum_occupancy / (double)worker->num_enqueued,
+        (uint64_t)(worker->ring_mask + 1) * worker->slot_size,
+        worker->max_retained_bytes);
+    if (worker->num_msgs > 0) {
+      printf("min_handoff_ns=%"PRIu64", max_handoff_ns=%"PRIu64", average_handoff_ns=%"PRIu64", num_batches=%"PRIu64", average_batch_msgs=%f, min_batch_ns=%"PRIu64", max_batch_ns=%"PRIu64", average_batch_ns=%"PRIu64", \n",
+          worker->min_handoff_ns, worker->max_handoff_ns,
+          worker->sum_handoff_ns / worker->num_msgs,
+          worker->num_batches,
+          (double)worker->num_msgs / (double)worker->num_batches,
+          worker->min_batch_ns, worker->max_batch_ns,
+          worker->sum_batch_ns / worker->num_batches);
+    } else {
+      printf("\n");
+    }
+    if (do_histogram && worker->handoff_hist.num_samples > 0) {
+      hist_print(&worker->handoff_hist);
+      hist_print(&worker->batch_hist);
+    }
+  }
+}  /* workers_print */
+
+
+/* Conflation (-C). The context thread stores each message as the latest
+ * value of its key (the publisher's "-K" key, or else msg_num) in a table
+ * of num_keys entries. A consumer thread takes updated keys from a ring
+ * and runs the workload on their latest values; an update that arrives
+ * before the previous one for the key was consumed replaces it
+ * (is conflated). Each entry is protected by a sequence lock. Whichever
+ * thread sets an entry's pending flag (compare-and-swap) owns queuing it,
+ * so a value is never consumed twice. As with the workers, the consumer
+ * resets its own statistics when it sees a new reset_gen. */
+#define CONFLATE_DATA_SIZE 256  /* Larger messages are truncated. */
+struct conflate_entry_s {
+  uint64_t version;  /* Odd while being written. */
+  int pending;  /* In the ring, not yet consumed. */
+  uint64_t msg_num;
+  struct timespec rcv_ts;
+  size_t len;
+  char data[CONFLATE_DATA_SIZE];
+};
+struct conflate_s {
+  /* Read-only after creation. */
+  struct conflate_entry_s *table;
+  uint64_t *ring;  /* Indexes of updated entries. */
+  uint64_t ring_mask;
+  int cpu;
+  CPRT_THREAD_T thread_id;
+  char pad1[CACHE_LINE_SIZE];
+  /* Written by the context thread. */
+  uint64_t head;
+  uint64_t num_updates;
+  uint64_t num_conflated;
+  uint64_t reset_gen;  /* Bumped to have the consumer reset its statistics. */
+  char pad2[CACHE_LINE_SIZE];
+  /* Written by the consumer thread. */
+  uint64_t tail;
+  uint64_t done_reset_gen;
+  uint64_t num_consumed;
+  uint64_t num_retaken;  /* Counted as conflated, but taken back by the consumer. */
+  uint64_t min_staleness_ns;
+  uint64_t max_staleness_ns;
+  uint64_t sum_staleness_ns;
+  hist_t staleness_hist;
+  workload_t workload;
+  char pad3[CACHE_LINE_SIZE];
+};
+typedef struct conflate_s conflate_t;
+
+conflate_t *conflate;
+
+/* Statistics written by the consumer thread. */
+void conflate_stats_init()
+{
+  conflate->num_consumed = 0;
+  conflate->num_retaken = 0;
+  conflate->min_staleness_ns = (uint64_t)-1;  /* max int */
+  conflate->max_staleness_ns = 0;
+  conflate->sum_staleness_ns = 0;
+  if (do_histogram) {
+    hist_init(&conflate->staleness_hist);
+  }
+}  /* conflate_stats_init */
+
+/* Called by the context thread at BOS. */
+void conflate_stats_reset()
+{
+  conflate->num_updates = 0;
+  conflate->num_conflated = 0;
+  __atomic_store_n(&conflate->reset_gen, conflate->reset_gen + 1, __ATOMIC_RELEASE);
+}  /* conflate_stats_reset */
+
+/* Called by the context thread, from the receiver callback. */
+void conflate_update(lbm_msg_t *msg, uint64_t key, uint64_t msg_num)
+{
+  uint64_t index = key % (uint64_t)conflate_num_keys;
+  struct conflate_entry_s *entry = &conflate->table[index];
+  size_t len = (msg->len < CONFLATE_DATA_SIZE) ? msg->len : CONFLATE_DATA_SIZE;
+
+  __atomic_store_n(&entry->version, entry->version + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  entry->msg_num = msg_num;
+  CPRT_GETTIME(&entry->rcv_ts);
+  entry->len = len;
+  memcpy(entry->data, msg->data, len);
+  __atomic_store_n(&entry->version, entry->version + 1, __ATOMIC_RELEASE);
+
+  conflate->num_updates++;
+  /* The consumer may be taking the entry back; the CAS also orders the
+   * version store before the pending load. */
+  if (! __sync_bool_compare_and_swap(&entry->pending, 0, 1)) {
+    conflate->num_conflated++;  /* Replaced an unconsumed value. */
+  }
+  else {
+    /* Each key is in the ring at most once, so it can't overflow. */
+    conflate->ring[conflate->head & conflate->ring_mask] = index;
+    __atomic_store_n(&conflate->head, conflate->head + 1, __ATOMIC_RELEASE);
+  }
+}  /* conflate_update */
+
+CPRT_THREAD_ENTRYPOINT conflate_thread(void *in_arg)
+{
+  struct conflate_entry_s value;
+  struct timespec consume_ts;
+  uint64_t cpuset;
+
+  if (conflate->cpu > -1) {
+    CPRT_CPU_ZERO(&cpuset);
+    CPRT_CPU_SET(conflate->cpu, &cpuset);
+    cprt_set_affinity(cpuset);
+  }
+
+  while (1) {
+    uint64_t tail = conflate->tail;
+    uint64_t head = __atomic_load_n(&conflate->head, __ATOMIC_ACQUIRE);
+    /* Checked after loading head, so a reset requested before an update
+     * was queued is done before that update is consumed. */
+    uint64_t reset_gen = __atomic_load_n(&conflate->reset_gen, __ATOMIC_ACQUIRE);
+    if (reset_gen != conflate->done_reset_gen) {
+      conflate_stats_init();
+      __atomic_store_n(&conflate->done_reset_gen, reset_gen, __ATOMIC_RELEASE);
+    }
+    if (tail == head) {
+      continue;  /* Busy-poll. */
+    }
+    struct conflate_entry_s *entry = &conflate->table[conflate->ring[tail & conflate->ring_mask]];
+    __atomic_store_n(&conflate->tail, tail + 1, __ATOMIC_RELEASE);
+
+    int retake;
+    do {
+      /* Copy the latest value, retrying if the context thread updated it. */
+      uint64_t version;
+      do {
+        version = __atomic_load_n(&entry->version, __ATOMIC_ACQUIRE);
+        if (version & 1) continue;
+        value.msg_num = entry->msg_num;
+        value.rcv_ts = entry->rcv_ts;
+        value.len = entry->len;
+        memcpy(value.data, entry->data, value.len);
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+      } while ((version & 1) || version != __atomic_load_n(&entry->version, __ATOMIC_RELAXED));
+
+      /* From here, a new update re-queues the key. An update since the
+       * copy found the entry still pending, so it was conflated and not
+       * queued; take the entry back, unless the context thread has since
+       * re-queued it. */
+      __atomic_store_n(&entry->pending, 0, __ATOMIC_SEQ_CST);
+      retake = (__atomic_load_n(&entry->version, __ATOMIC_SEQ_CST) != version &&
+          __sync_bool_compare_and_swap(&entry->pending, 0, 1));
+      if (retake) {
+        __atomic_store_n(&conflate->num_retaken, conflate->num_retaken + 1, __ATOMIC_RELEASE);
+      }
+
+      /* Staleness: time from receipt of the value to its consumption. */
+      uint64_t staleness_ns;
+      CPRT_GETTIME(&consume_ts);
+      CPRT_DIFF_TS(staleness_ns, consume_ts, value.rcv_ts);
+      if (staleness_ns < conflate->min_staleness_ns) conflate->min_staleness_ns = staleness_ns;
+      if (staleness_ns > conflate->max_staleness_ns) conflate->max_staleness_ns = staleness_ns;
+      conflate->sum_staleness_ns += staleness_ns;
+      if (do_histogram) {
+        hist_input(&conflate->staleness_hist, staleness_ns);
+      }
+
+      if (workload_type != WORKLOAD_NONE) {
+        workload_run(&conflate->workload, value.data, value.len, value.msg_num);
+      }
+      __atomic_store_n(&conflate->num_consumed, conflate->num_consumed + 1, __ATOMIC_RELEASE);
+    } while (retake);
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* conflate_thread */
+
+void conflate_create()
+{
+  uint64_t ring_size = 1;
+
+  conflate = (conflate_t *)cache_aligned_alloc(sizeof(conflate_t));
+  memset(conflate, 0, sizeof(*conflate));
+  conflate->table = (struct conflate_entry_s *)cache_aligned_alloc(
+      conflate_num_keys * sizeof(struct conflate_entry_s));
+  memset(conflate->table, 0, conflate_num_keys * sizeof(struct conflate_entry_s));
+  while (ring_size < (uint64_t)conflate_num_keys) ring_size <<= 1;
+  conflate->ring = (uint64_t *)cache_aligned_alloc(ring_size * sizeof(uint64_t));
+  memset(conflate->ring, 0, ring_size * sizeof(uint64_t));
+  conflate->ring_mask = ring_size - 1;
+  conflate->cpu = conflate_cpu;
+  if (do_histogram) {
+    hist_create(&conflate->staleness_hist, "staleness_ns",
+        hist_num_buckets, hist_ns_per_bucket);
+  }
+  conflate_stats_init();
+  workload_init(&conflate->workload);
+
+  CPRT_THREAD_CREATE(conflate->thread_id, conflate_thread, NULL);
+}  /* conflate_create */
+
+/* Called by the context thread at the end of a test run. */
+void conflate_print()
+{
+  /* Let the consumer catch up (and reset its statistics, if it got no
+   * updates). A retaken update is consumed after num_retaken is bumped. */
+  uint64_t num_consumed, num_retaken;
+  do {
+    num_consumed = __atomic_load_n(&conflate->num_consumed, __ATOMIC_ACQUIRE);
+    num_retaken = __atomic_load_n(&conflate->num_retaken, __ATOMIC_ACQUIRE);
+  } while (__atomic_load_n(&conflate->done_reset_gen, __ATOMIC_ACQUIRE) != conflate->reset_gen ||
+      num_consumed < conflate->num_updates - conflate->num_conflated + num_retaken);
+
+  printf("rcv event EOS conflate, num_keys=%d, num_updates=%"PRIu64", num_conflated=%"PRIu64", num_consumed=%"PRIu64", conflation_ratio=%f, ",
+      conflate_num_keys, conflate->num_updates,
+      conflate->num_conflated - conflate->num_retaken, conflate->num_consumed,
+      (conflate->num_consumed == 0) ? 0.0 :
+      (double)conflate->num_updates / (double)conflate->num_consumed);
+  if (conflate->num_consumed > 0) {
+    printf("min_staleness_ns=%"PRIu64", max_staleness_ns=%"PRIu64", average_staleness_ns=%"PRIu64", \n",
+        conflate->min_staleness_ns, conflate->max_staleness_ns,
+        conflate->sum_staleness_ns / conflate->num_consumed);
+  } else {
+    printf("\n");
+  }
+  if (do_histogram && conflate->staleness_hist.num_samples > 0) {
+    hist_print(&conflate->staleness_hist);
+  }
+}  /* conflate_print */
+
+
+/* XSPs (-X). Each XSP is a separate UM receive context with its own thread,
+ * which is pinned and runs lbm_xsp_process_events(). New transport sessions
+ * are assigned to XSPs round-robin by the context's transport mapping
+ * function. Each XSP thread also keeps totals of the sources it handled. */
+struct xsp_state_s {
+  rcv_stats_t stats;  /* Written only by this XSP's thread. */
+  uint64_t num_srcs;
+  lbm_xsp_t *xsp;
+  int index;
+  int cpu;
+  CPRT_THREAD_T thread_id;
+  char pad[CACHE_LINE_SIZE];
+};
+typedef struct xsp_state_s xsp_state_t;
+
+xsp_state_t *xsps;
+int next_xsp;  /* Round-robin mapping. */
+/* The XSP whose thread is running (NULL on the main context thread). */
+__thread xsp_state_t *cur_xsp;
+/* With XSPs, the cross-source state (BOS/EOS accounting, the recovery
+ * histograms, and output) is shared by multiple threads. */
+CPRT_MUTEX_T shared_lock;
+
+void shared_lock_acquire()
+{
+  if (num_xsps > 0) {
+    CPRT_MUTEX_LOCK(shared_lock);
+  }
+}  /* shared_lock_acquire */
+
+void shared_lock_release()
+{
+  if (num_xsps > 0) {
+    CPRT_MUTEX_UNLOCK(shared_lock);
+  }
+}  /* shared_lock_release */
+
+/* Histogram inputs from the receiver callback, which can be on any XSP. */
+void shared_hist_input(hist_t *hist, uint64_t in_sample)
+{
+  shared_lock_acquire();
+  hist_input(hist, in_sample);
+  shared_lock_release();
+}  /* shared_hist_input */
+
+lbm_xsp_t *xsp_mapping_cb(lbm_context_t *ctx, lbm_new_transport_info_t *transp_info, void *clientd)
+{
+  xsp_state_t *xsp_state = &xsps[next_xsp];
+  next_xsp = (next_xsp + 1) % num_xsps;
+
+  return xsp_state->xsp;
+}  /* xsp_mapping_cb */
+
+CPRT_THREAD_ENTRYPOINT xsp_thread(void *in_arg)
+{
+  xsp_state_t *xsp_state = (xsp_state_t *)in_arg;
+  uint64_t cpuset;
+
+  if (xsp_state->cpu > -1) {
+    CPRT_CPU_ZERO(&cpuset);
+    CPRT_CPU_SET(xsp_state->cpu, &cpuset);
+    cprt_set_affinity(cpuset);
+  }
+  cur_xsp = xsp_state;
+
+  while (1) {
+    E(lbm_xsp_process_events(xsp_state->xsp, 1000));
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* xsp_thread */
+
+void xsps_create(lbm_context_t *ctx)
+{
+  lbm_context_attr_t *xsp_ctx_attr;
+  int i;
+
+  /* The XSPs are run by xsp_thread(). */
+  E(lbm_context_attr_create(&xsp_ctx_attr));
+  E(lbm_context_attr_str_setopt(xsp_ctx_attr, "operational_mode", "sequential"));
+
+  xsps = (xsp_state_t *)cache_aligned_alloc(num_xsps * sizeof(xsp_state_t));
+  for (i = 0; i < num_xsps; i++) {
+    xsp_state_t *xsp_state = &xsps[i];
+    memset(xsp_state, 0, sizeof(*xsp_state));
+    rcv_stats_init(&xsp_state->stats);
+    xsp_state->index = i;
+    xsp_state->cpu = (xsp_first_cpu > -1) ? (xsp_first_cpu + i) : -1;
+    E(lbm_xsp_create(&xsp_state->xsp, ctx, xsp_ctx_attr, NULL));
+
+    CPRT_THREAD_CREATE(xsp_state->thread_id, xsp_thread, xsp_state);
+  }
+
+  E(lbm_context_attr_delete(xsp_ctx_attr));
+}  /* xsps_create */
+
+/* Called at the end of a test run, after all sources have ended. */
+void xsps_print()
+{
+  int i;
+  char xsp_name[32];
+
+  for (i = 0; i < num_xsps; i++) {
+    xsp_state_t *xsp_state = &xsps[i];
+    snprintf(xsp_name, sizeof(xsp_name), "xsp %d", i);
+    printf("rcv event EOS xsp, index=%d, cpu=%d, num_srcs=%"PRIu64", \n",
+        i, xsp_state->cpu, xsp_state->num_srcs);
+    rcv_stats_print(&xsp_state->stats, o_topics, xsp_name);
+    rcv_stats_init(&xsp_state->stats);
+    xsp_state->num_srcs = 0;
+  }
+}  /* xsps_print */
+
+
+/* Event queue (-Q). Receiver events are queued by the context thread and
+ * delivered by evq_dispatch_thread(), which busy-polls the queue; each
+ * lbm_event_dispatch() call delivers everything queued (a batch). Since
+ * the dispatch thread runs rcv_callback(), -a pins it at BOS.
+ * evq_sample_thread() periodically samples the queue's depth and the
+ * age of queued events (enqueue to dispatch), as measured by UM. The
+ * sample histograms are initialized and printed by rcv_callback() (on the
+ * dispatch thread), so evq_sample_lock protects them. */
+lbm_event_queue_t *evq;
+/* The dispatch thread's counters, on their own cache line. Since -Q and -X
+ * are mutually exclusive, the dispatch thread is the only writer. */
+struct evq_state_s {
+  uint64_t dispatched_msgs;  /* Counted by rcv_callback(). */
+  uint64_t prev_dispatched_msgs;  /* At the end of the previous dispatch. */
+  char pad[CACHE_LINE_SIZE];
+};
+typedef struct evq_state_s evq_state_t;
+evq_state_t *evq_state;
+hist_t evq_batch_hist;  /* Messages per dispatch call. */
+hist_t evq_depth_hist;  /* Messages in the queue, per sample. */
+hist_t evq_age_hist;  /* ns, max enqueue to dispatch time, per sample. */
+CPRT_MUTEX_T evq_sample_lock;
+
+CPRT_THREAD_ENTRYPOINT evq_dispatch_thread(void *in_arg)
+{
+  while (1) {
+    E(lbm_event_dispatch(evq, LBM_EVENT_QUEUE_POLL));
+    uint64_t batch = evq_state->dispatched_msgs - evq_state->prev_dispatched_msgs;
+    if (batch > 0 && do_histogram) {
+      hist_input(&evq_batch_hist, batch);
+    }
+    evq_state->prev_dispatched_msgs = evq_state->dispatched_msgs;
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* evq_dispatch_thread */
+
+CPRT_THREAD_ENTRYPOINT evq_sample_thread(void *in_arg)
+{
+  lbm_event_queue_stats_t evq_stats;
+
+  while (1) {
+    usleep(o_evq_sample_ms * 1000);
+
+    E(lbm_event_queue_retrieve_stats(evq, &evq_stats));
+    E(lbm_event_queue_reset_stats(evq));  /* Make min/mean/max per interval. */
+
+    /* Leave "comma space" at end of line to make parsing output easier. */
+    printf("evq, ms_time=%"PRIu64", data_msgs=%lu, data_msgs_tot=%lu, age_mean_us=%lu, age_max_us=%lu, svc_mean_us=%lu, svc_max_us=%lu, \n",
+        cprt_get_ms_time(), evq_stats.data_msgs, evq_stats.data_msgs_tot,
+        evq_stats.age_mean, evq_stats.age_max,
+        evq_stats.data_msgs_svc_mean, evq_stats.data_msgs_svc_max);
+    fflush(stdout);
+
+    if (do_histogram) {
+      CPRT_MUTEX_LOCK(evq_sample_lock);
+      if (num_active_srcs > 0) {
+        hist_input(&evq_depth_hist, evq_stats.data_msgs);
+        hist_input(&evq_age_hist, (uint64_t)evq_stats.age_max * 1000);
+      }
+      CPRT_MUTEX_UNLOCK(evq_sample_lock);
+    }
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* evq_sample_thread */
+
+void evq_create()
+{
+  lbm_event_queue_attr_t *evq_attr;
+  CPRT_THREAD_T dispatch_thread_id;
+  CPRT_THREAD_T sample_thread_id;
+
+  E(lbm_event_queue_attr_create(&evq_attr));
+  E(lbm_event_queue_attr_str_setopt(evq_attr, "queue_age_enabled", "1"));
+  E(lbm_event_queue_attr_str_setopt(evq_attr, "queue_count_enabled", "1"));
+  E(lbm_event_queue_attr_str_setopt(evq_attr, "queue_service_time_enabled", "1"));
+  E(lbm_event_queue_create(&evq, NULL, NULL, evq_attr));
+  E(lbm_event_queue_attr_delete(evq_attr));
+
+  evq_state = (evq_state_t *)cache_aligned_alloc(sizeof(evq_state_t));
+  evq_state->dispatched_msgs = 0;
+  evq_state->prev_dispatched_msgs = 0;
+
+  CPRT_MUTEX_INIT(evq_sample_lock);
+  if (do_histogram) {
+    hist_create(&evq_batch_hist, "evq_batch_msgs", hist_num_buckets, 1);
+    hist_create(&evq_depth_hist, "evq_depth_msgs", hist_num_buckets, 1);
+    hist_create(&evq_age_hist, "evq_age_ns", hist_num_buckets, hist_ns_per_bucket);
+  }
+
+  CPRT_THREAD_CREATE(dispatch_thread_id, evq_dispatch_thread, NULL);
+  CPRT_THREAD_CREATE(sample_thread_id, evq_sample_thread, NULL);
+}  /* evq_create */
+
+
+/* Transport statistics (-S). A low-priority thread periodically retrieves
+ * UM's context and receiver transport statistics and prints them as "xport"
+ * lines, which line up with the "evq" lines (-Q) and um_perf_pub's output by
+ * ms_time. The values are UM's running totals since the context was
+ * created. */
+void xport_rcv_stats_print(uint64_t ms_time, lbm_rcv_transport_stats_t *st)
+{
+  /* Leave "comma space" at end of line to make parsing output easier. */
+  switch (st->type) {
+    case LBM_TRANSPORT_STAT_LBTRM:
+      printf("xport rcv lbtrm, ms_time=%"PRIu64", source=%s, msgs_rcved=%lu, bytes_rcved=%lu, naks_sent=%lu, nak_pckts_sent=%lu, lost=%lu, unrecovered_txw=%lu, unrecovered_tmo=%lu, duplicate_data=%lu, out_of_order=%lu, ncfs_ignored=%lu, ncfs_shed=%lu, ncfs_rx_delay=%lu, dgrams_dropped=%lu, \n",
+          ms_time, st->source, st->transport.lbtrm.msgs_rcved, st->transport.lbtrm.bytes_rcved,
+          st->transport.lbtrm.naks_sent, st->transport.lbtrm.nak_pckts_sent,
+          st->transport.lbtrm.lost, st->transport.lbtrm.unrecovered_txw,
+          st->transport.lbtrm.unrecovered_tmo, st->transport.lbtrm.duplicate_data,
+          st->transport.lbtrm.out_of_order, st->transport.lbtrm.ncfs_ignored,
+          st->transport.lbtrm.ncfs_shed, st->transport.lbtrm.ncfs_rx_delay,
+          st->transport.lbtrm.dgrams_dropped_size + st->transport.lbtrm.dgrams_dropped_type +
+          st->transport.lbtrm.dgrams_dropped_version + st->transport.lbtrm.dgrams_dropped_hdr +
+          st->transport.lbtrm.dgrams_dropped_other);
+      break;
+    case LBM_TRANSPORT_STAT_LBTRU:
+      printf("xport rcv lbtru, ms_time=%"PRIu64", source=%s, msgs_rcved=%lu, bytes_rcved=%lu, naks_sent=%lu, nak_pckts_sent=%lu, lost=%lu, unrecovered_txw=%lu, unrecovered_tmo=%lu, duplicate_data=%lu, ncfs_ignored=%lu, ncfs_shed=%lu, ncfs_rx_delay=%lu, \n",
+          ms_time, st->source, st->transport.lbtru.msgs_rcved, st->transport.lbtru.bytes_rcved,
+          st->transport.lbtru.naks_sent, st->transport.lbtru.nak_pckts_sent,
+          st->transport.lbtru.lost, st->transport.lbtru.unrecovered_txw,
+          st->transport.lbtru.unrecovered_tmo, st->transport.lbtru.duplicate_data,
+          st->transport.lbtru.ncfs_ignored, st->transport.lbtru.ncfs_shed,
+          st->transport.lbtru.ncfs_rx_delay);
+      break;
+    case LBM_TRANSPORT_STAT_TCP:
+      printf("xport rcv tcp, ms_time=%"PRIu64", source=%s, bytes_rcved=%lu, lbm_msgs_rcved=%lu, \n",
+          ms_time, st->source, st->transport.tcp.bytes_rcved, st->transport.tcp.lbm_msgs_rcved);
+      break;
+    case LBM_TRANSPORT_STAT_LBTIPC:
+      printf("xport rcv lbtipc, ms_time=%"PRIu64", source=%s, msgs_rcved=%lu, bytes_rcved=%lu, lbm_msgs_rcved=%lu, \n",
+          ms_time, st->source, st->transport.lbtipc.msgs_rcved,
+          st->transport.lbtipc.bytes_rcved, st->transport.lbtipc.lbm_msgs_rcved);
+      break;
+    case LBM_TRANSPORT_STAT_LBTSMX:
+      printf("xport rcv lbtsmx, ms_time=%"PRIu64", source=%s, msgs_rcved=%lu, bytes_rcved=%lu, lbm_msgs_rcved=%lu, \n",
+          ms_time, st->source, st->transport.lbtsmx.msgs_rcved,
+          st->transport.lbtsmx.bytes_rcved, st->transport.lbtsmx.lbm_msgs_rcved);
+      break;
+    default:
+      printf("xport rcv %d, ms_time=%"PRIu64", source=%s, \n", st->type, ms_time, st->source);
+  }
+}  /* xport_rcv_stats_print */
+
+CPRT_THREAD_ENTRYPOINT xport_stats_thread(void *in_arg)
+{
+  lbm_context_t *ctx = (lbm_context_t *)in_arg;
+  lbm_context_stats_t ctx_stats;
+  lbm_rcv_transport_stats_t *rcv_stats;
+  int num_stats;
+  int i;
+
+  cprt_set_priority_low();
+  rcv_stats = (lbm_rcv_transport_stats_t *)malloc(
+      MAX_XPORT_STATS * sizeof(lbm_rcv_transport_stats_t));
+  ASSRT(rcv_stats != NULL);
+
+  while (! stats_exit) {
+    usleep(o_xport_stats_ms * 1000);
+    uint64_t ms_time = cprt_get_ms_time();
+
+    E(lbm_context_retrieve_stats(ctx, &ctx_stats));
+    printf("xport ctx, ms_time=%"PRIu64", dgrams_sent=%lu, dgrams_rcved=%lu, dgrams_dropped=%lu, dgrams_send_failed=%lu, fragments_lost=%lu, fragments_unrecoverably_lost=%lu, \n",
+        ms_time, ctx_stats.tr_dgrams_sent, ctx_stats.tr_dgrams_rcved,
+        ctx_stats.tr_dgrams_dropped_ver + ctx_stats.tr_dgrams_dropped_type +
+        ctx_stats.tr_dgrams_dropped_malformed,
+        ctx_stats.tr_dgrams_send_failed, ctx_stats.fragments_lost,
+        ctx_stats.fragments_unrecoverably_lost);
+
+    num_stats = MAX_XPORT_STATS;
+    E(lbm_context_retrieve_rcv_transport_stats(ctx, &num_stats, rcv_stats));
+    for (i = 0; i < num_stats; i++) {
+      xport_rcv_stats_print(ms_time, &rcv_stats[i]);
+    }
+    fflush(stdout);
+  }
+
+  free(rcv_stats);
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* xport_stats_thread */
+
+
+/* Round-trip mode (-R). After a message is processed (including -W),
+ * rcv_callback() sends it back unchanged, either as the response to a UM
+ * request ("req") or on the pong topic ("pong"), for um_perf_pub -R to
+ * measure the round-trip time. */
+lbm_src_t *rtt_pong_src;
+
+void rtt_reply(lbm_msg_t *msg)
+{
+  if (rtt_mode == RTT_REQ && msg->type == LBM_MSG_REQUEST) {
+    E(lbm_send_response(msg->response, msg->data, msg->len, LBM_SRC_NONBLOCK));
+  }
+  else if (rtt_mode == RTT_PONG) {
+    E(lbm_src_send(rtt_pong_src, msg->data, msg->len, LBM_SRC_NONBLOCK));
+  }
+}  /* rtt_reply */
+
+
+/* Explicit acks (-A). The receiver is configured with
+ * "ume_explicit_ack_only", so the Store and the source only see the acks
+ * that um_perf_sub sends. Acking a sequence number also acknowledges the
+ * earlier un-acked messages from that source, so a batch costs one ack.
+ * rcv_callback() extracts an ack handle from the first message of each
+ * batch, and only records the sequence number of the others, so there is
+ * no lock or message retain per message. The batch is acked by
+ * rcv_callback() when it reaches ack_batch_msgs messages, by
+ * ack_timer_thread() once it has been pending for ack_interval_us (so the
+ * last batch of a burst is acked too), and at EOS. */
+void ack_send(src_state_t *src_state, lbm_uint_t sqn)
+{
+  lbm_ume_rcv_ack_t *ack = __atomic_exchange_n(&src_state->ack, NULL, __ATOMIC_ACQ_REL);
+
+  if (ack != NULL) {  /* Else ack_timer_thread() just sent it. */
+    if (lbm_ume_ack_send_explicit_ack(ack, sqn) == LBM_FAILURE) {
+      src_state->stats.num_ack_fails++;
+    } else {
+      src_state->stats.num_acks++;
+    }
+    E(lbm_ume_ack_delete(ack));
+  }
+  src_state->ack_pending_msgs = 0;
+}  /* ack_send */
+
+CPRT_THREAD_ENTRYPOINT ack_timer_thread(void *in_arg)
+{
+  struct timespec cur_ts;
+  uint64_t cur_ns;
+  src_state_t *src_state;
+  lbm_ume_rcv_ack_t *ack;
+
+  while (1) {
+    usleep(ack_interval_us);
+
+    CPRT_GETTIME(&cur_ts);
+    cur_ns = (uint64_t)cur_ts.tv_sec * 1000000000 + cur_ts.tv_nsec;
+    CPRT_MUTEX_LOCK(ack_srcs_lock);
+    for (src_state = ack_srcs; src_state != NULL; src_state = src_state->ack_next) {
+      if (__atomic_load_n(&src_state->ack, __ATOMIC_ACQUIRE) != NULL &&
+          cur_ns - __atomic_load_n(&src_state->ack_pending_ns, __ATOMIC_RELAXED) >=
+            (uint64_t)ack_interval_us * 1000)
+      {
+        ack = __atomic_exchange_n(&src_state->ack, NULL, __ATOMIC_ACQ_REL);
+        if (ack != NULL) {  /* Else rcv_callback() just sent it. */
+          if (lbm_ume_ack_send_explicit_ack(ack,
+              __atomic_load_n(&src_state->ack_sqn, __ATOMIC_ACQUIRE)) == LBM_FAILURE)
+          {
+            __atomic_add_fetch(&src_state->num_timer_ack_fails, 1, __ATOMIC_RELAXED);
+          } else {
+            __atomic_add_fetch(&src_state->num_timer_acks, 1, __ATOMIC_RELAXED);
+          }
+          E(lbm_ume_ack_delete(ack));
+        }
+      }
+    }
+    CPRT_MUTEX_UNLOCK(ack_srcs_lock);
+  }
+
+  CPRT_THREAD_EXIT;
+  return 0;
+}  /* ack_timer_thread */
+
+void explicit_ack(src_state_t *src_state, lbm_msg_t *msg)
+{
+  __atomic_store_n(&src_state->ack_sqn, msg->sequence_number, __ATOMIC_RELEASE);
+
+  /* A NULL handle with messages pending means ack_timer_thread() acked
+   * the batch. */
+  if (src_state->ack_pending_msgs > 0 &&
+      __atomic_load_n(&src_state->ack, __ATOMIC_ACQUIRE) == NULL)
+  {
+    src_state->ack_pending_msgs = 0;
+  }
+
+  if (src_state->ack_pending_msgs == 0) {
+    lbm_ume_rcv_ack_t *ack;
+    struct timespec cur_ts;
+    /* Fails if the message isn't from a persistent source. */
+    if (lbm_msg_extract_ume_ack(msg, &ack) == LBM_FAILURE) {
+      src_state->stats.num_ack_fails++;
+      return;
+    }
+    CPRT_GETTIME(&cur_ts);
+    __atomic_store_n(&src_state->ack_pending_ns,
+        (uint64_t)cur_ts.tv_sec * 1000000000 + cur_ts.tv_nsec, __ATOMIC_RELAXED);
+    __atomic_store_n(&src_state->ack, ack, __ATOMIC_RELEASE);
+  }
+  src_state->ack_pending_msgs++;
+
+  if (ack_batch_msgs > 0 && src_state->ack_pending_msgs >= ack_batch_msgs) {
+    ack_send(src_state, msg->sequence_number);
+  }
+}  /* explicit_ack */
+
+/* Called at EOS; acks the final partial batch, and folds the timer's ack
+ * counts into the source's stats. */
+void explicit_ack_finish(src_state_t *src_state)
+{
+  if (src_state->ack_pending_msgs > 0) {
+    ack_send(src_state, __atomic_load_n(&src_state->ack_sqn, __ATOMIC_ACQUIRE));
+  }
+  src_state->stats.num_acks += __atomic_exchange_n(&src_state->num_timer_acks, 0, __ATOMIC_RELAXED);
+  src_state->stats.num_ack_fails += __atomic_exchange_n(&src_state->num_timer_ack_fails, 0, __ATOMIC_RELAXED);
+}  /* explicit_ack_finish */
+
+
 /* UM callback for receiver events, including received messages. */
 int rcv_callback(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 {
-  static uint64_t num_rcv_msgs;
-  static uint64_t num_rx_msgs;
-  static uint64_t num_unrec_loss;
-  static uint64_t min_latency;
-  static uint64_t max_latency;
-  static uint64_t sum_latencies;  /* For calculating average latencies. */
-  static uint64_t num_timestamps; /* For calculating average latencies. */
   uint64_t cpuset;
+  int i;
+  src_state_t *src_state = (src_state_t *)msg->source_clientd;
+  rcv_stats_t *stats = &src_state->stats;
 
   switch (msg->type) {
   case LBM_MSG_BOS:
     /* Assume receive thread is calling this; pin the time-critical thread
-     * to the requested CPU. */
-    if (o_affinity_cpu > -1) {
+     * to the requested CPU. XSP threads are already pinned. */
+    if (o_affinity_cpu > -1 && cur_xsp == NULL) {
       CPRT_CPU_ZERO(&cpuset);
       CPRT_CPU_SET(o_affinity_cpu, &cpuset);
       cprt_set_affinity(cpuset);
     }
 
-    num_rcv_msgs = 0;
-    num_rx_msgs = 0;
-    num_unrec_loss = 0;
-    min_latency = (uint64_t)-1;  /* max int */
-    max_latency = 0;
-    sum_latencies = 0;
-    num_timestamps = 0;
+    rcv_stats_init(stats);
+    CPRT_GETTIME(&stats->bos_ts);
+    shared_lock_acquire();
+    if (num_active_srcs == 0) {
+      /* First source of a test run. */
+      rcv_stats_init(&all_stats);
+      all_stats.bos_ts = stats->bos_ts;
+      for (i = 0; i < num_workers; i++) {
+        worker_stats_reset(&workers[i]);
+      }
+      if (conflate != NULL) {
+        conflate_stats_reset();
+      }
+      seq_track_init(&msg_num_track);
+      if (do_histogram) {
+        hist_init(&recovered_latency_hist);
+        hist_init(&gap_size_hist);
+        hist_init(&gap_recovery_hist);
+        if (evq != NULL) {
+          hist_init(&evq_batch_hist);
+          CPRT_MUTEX_LOCK(evq_sample_lock);
+          hist_init(&evq_depth_hist);
+          hist_init(&evq_age_hist);
+          CPRT_MUTEX_UNLOCK(evq_sample_lock);
+        }
+      }
+    }
+    num_active_srcs++;
     printf("rcv event BOS, topic_name='%s', source=%s, \n",
       msg->topic_name, msg->source);
+    if (transport_source_prefix != NULL &&
+        strncmp(msg->source, transport_source_prefix, strlen(transport_source_prefix)) != 0)
+    {
+      printf("rcv event BOS, WARNING: source=%s is not transport %s, \n",
+        msg->source, o_transport);
+    }
     fflush(stdout);
+    shared_lock_release();
     break;
 
   case LBM_MSG_EOS:
-    if (num_timestamps > 0) {
-      printf("rcv event EOS, '%s', %s, num_rcv_msgs=%"PRIu64", num_rx_msgs=%"PRIu64", num_unrec_loss=%"PRIu64", min_latency=%"PRIu64", max_latency=%"PRIu64", average latency=%"PRIu64", \n",
-          msg->topic_name, msg->source, num_rcv_msgs, num_rx_msgs, num_unrec_loss,
-          min_latency, max_latency, sum_latencies / num_timestamps);
-    } else {
-      printf("rcv event EOS, '%s', %s, num_rcv_msgs=%"PRIu64", num_rx_msgs=%"PRIu64", num_unrec_loss=%"PRIu64",\n",
-          msg->topic_name, msg->source, num_rcv_msgs, num_rx_msgs, num_unrec_loss);
+    if (do_explicit_ack) {
+      explicit_ack_finish(src_state);  /* Before the ack counts are printed. */
+    }
+    if (cur_xsp != NULL) {
+      rcv_stats_add(&cur_xsp->stats, stats);
+      cur_xsp->num_srcs++;
+    }
+    shared_lock_acquire();
+    rcv_stats_print(stats, msg->topic_name, msg->source);
+    seq_track_finish(&src_state->seq_track);
+    seq_track_print(&src_state->seq_track, "seq", msg->topic_name, msg->source);
+    if (src_state->msg_num_track.valid) {
+      seq_track_finish(&src_state->msg_num_track);
+      seq_track_print(&src_state->msg_num_track, "msg_num", msg->topic_name, msg->source);
+    }
+    rcv_stats_add(&all_stats, stats);
+
+    num_active_srcs--;
+    if (num_active_srcs == 0) {
+      /* Last source; totals across all sources. */
+      rcv_stats_print(&all_stats, o_topics, "all sources");
+      if (num_xsps == 0 && msg_num_track.valid) {
+        seq_track_finish(&msg_num_track);
+        seq_track_print(&msg_num_track, "msg_num", o_topics, "all sources");
+      }
+      workers_print();
+      if (conflate != NULL) {
+        conflate_print();
+      }
+      xsps_print();
+
+      if (do_histogram) {
+        if (recovered_latency_hist.num_samples > 0) {
+          hist_print(&recovered_latency_hist);
+        }
+        if (gap_size_hist.num_samples > 0) {
+          hist_print(&gap_size_hist);
+        }
+        if (gap_recovery_hist.num_samples > 0) {
+          hist_print(&gap_recovery_hist);
+        }
+        if (evq != NULL) {
+          hist_print(&evq_batch_hist);
+          CPRT_MUTEX_LOCK(evq_sample_lock);
+          hist_print(&evq_depth_hist);
+          hist_print(&evq_age_hist);
+          CPRT_MUTEX_UNLOCK(evq_sample_lock);
+        }
+      }
     }
     fflush(stdout);
 
-    if (o_exit_on_eos) {
-      CPRT_NET_CLEANUP;
-      exit(0);
+    if (o_exit_on_eos && num_active_srcs == 0) {
+      exit_requested = 1;  /* The main thread exits. */
     }
+    shared_lock_release();
     break;
 
   case LBM_MSG_UME_REGISTRATION_ERROR:
@@ -190,36 +2093,145 @@ int rcv_callback(lbm_rcv_t *rcv, lbm_msg_t *msg, void *clientd)
 
   case LBM_MSG_UNRECOVERABLE_LOSS:
   {
-    num_unrec_loss++;
+    stats->num_unrec_loss++;
+    if (stats->gap_outstanding && (msg->sequence_number + 1) == stats->gap_end_seq) {
+      stats->gap_outstanding = 0;  /* Last missing message won't be recovered. */
+    }
     break;
   }
 
+  case LBM_MSG_REQUEST:  /* Handled as data, then answered (-R req). */
   case LBM_MSG_DATA:
   {
     perf_msg_t *perf_msg = (perf_msg_t *)msg->data;
+    struct timespec cur_ts;
+    int is_recovered = ((msg->flags &
+        (LBM_MSG_FLAG_RETRANSMIT | LBM_MSG_FLAG_UME_RETRANSMIT)) != 0);
+
+    /* Not from um_perf_pub, or from one with an older, smaller perf_msg_t. */
+    if (msg->len < sizeof(perf_msg_t)) {
+      stats->num_short_msgs++;
+      if (do_explicit_ack) {
+        explicit_ack(src_state, msg);
+      }
+      break;
+    }
 
     if ((perf_msg->flags & FLAGS_TIMESTAMP) == FLAGS_TIMESTAMP) {
-      struct timespec cur_ts;
       uint64_t diff_ns;
       /* Calculate one-way latency for this message. */
       CPRT_GETTIME(&cur_ts);
       CPRT_DIFF_TS(diff_ns, cur_ts, perf_msg->send_ts);
 
-      if (diff_ns < min_latency) min_latency = diff_ns;
-      if (diff_ns > max_latency) max_latency = diff_ns;
-      sum_latencies += diff_ns;
-      num_timestamps++;
+      if (is_recovered && do_histogram) {
+        shared_hist_input(&recovered_latency_hist, diff_ns);
+      }
+
+      if (diff_ns < stats->min_latency) stats->min_latency = diff_ns;
+      if (diff_ns > stats->max_latency) stats->max_latency = diff_ns;
+      stats->sum_latencies += diff_ns;
+      stats->num_timestamps++;
+
+      /* A live message that was sent before recovery finished was queued
+       * behind the recovered messages; its latency is the cost of
+       * recovery to live traffic. The last one marks "caught up". */
+      if (!is_recovered && stats->num_recovered_msgs > 0) {
+        uint64_t sent_after_recovery_ns;
+        CPRT_DIFF_TS(sent_after_recovery_ns, perf_msg->send_ts, stats->last_recovered_ts);
+        if ((int64_t)sent_after_recovery_ns <= 0) {
+          if (diff_ns < stats->min_live_during_recovery_latency) stats->min_live_during_recovery_latency = diff_ns;
+          if (diff_ns > stats->max_live_during_recovery_latency) stats->max_live_during_recovery_latency = diff_ns;
+          stats->sum_live_during_recovery_latencies += diff_ns;
+          stats->num_live_during_recovery++;
+          stats->caught_up_ts = cur_ts;
+        }
+      }
+    }
+    else if (is_recovered || stats->gap_outstanding) {
+      CPRT_GETTIME(&cur_ts);
     }
 
-    num_rcv_msgs++;
+    /* A live message beyond the expected sequence number reveals a gap
+     * (only visible with arrival-order delivery, "ordered_delivery 0",
+     * which -H sets). */
+    if (! stats->seq_valid) {
+      stats->expected_seq = msg->sequence_number;
+      stats->seq_valid = 1;
+    }
+    int32_t seq_ahead = (int32_t)(msg->sequence_number - stats->expected_seq);
+    if (seq_ahead > 0 && ! is_recovered) {
+      if (! stats->gap_outstanding) {
+        CPRT_GETTIME(&stats->gap_detect_ts);
+        stats->gap_outstanding = 1;
+      }
+      stats->gap_end_seq = msg->sequence_number;
+      stats->num_gaps++;
+      if (seq_ahead > stats->max_gap_size) stats->max_gap_size = seq_ahead;
+      if (do_histogram) {
+        shared_hist_input(&gap_size_hist, seq_ahead);
+      }
+    }
+    if (seq_ahead >= 0) {
+      stats->expected_seq = msg->sequence_number + 1;
+    }
+    else if (is_recovered && stats->gap_outstanding) {
+      /* Fills a hole behind the expected sequence number. */
+      if (do_histogram) {
+        uint64_t gap_ns;
+        CPRT_DIFF_TS(gap_ns, cur_ts, stats->gap_detect_ts);
+        shared_hist_input(&gap_recovery_hist, gap_ns);
+      }
+      if ((msg->sequence_number + 1) == stats->gap_end_seq) {
+        stats->gap_outstanding = 0;
+      }
+    }
+
+    /* Per-source tracking uses the UM sequence number (contiguous per source,
+     * unlike msg_num when load balancing). */
+    src_state->ext_seq += (int32_t)(msg->sequence_number - (lbm_uint_t)src_state->ext_seq);
+    seq_track_input(&src_state->seq_track, src_state->ext_seq);
+    if ((perf_msg->flags & FLAGS_LOAD_BALANCE) == 0) {
+      seq_track_input(&src_state->msg_num_track, perf_msg->msg_num);
+    }
+    else if (num_xsps == 0) {
+      /* With XSPs, this would have to be locked for every message. */
+      seq_track_input(&msg_num_track, perf_msg->msg_num);
+    }
+
+    stats->num_rcv_msgs++;
+    if (evq != NULL) {
+      evq_state->dispatched_msgs++;
+    }
     if ((msg->flags & LBM_MSG_FLAG_RETRANSMIT) == LBM_MSG_FLAG_RETRANSMIT) {
-      num_rx_msgs++;
+      stats->num_rx_msgs++;
     }
- 
-    /* This "counter" loop is to introduce short delays into the receiver. */
-    if (o_spin_cnt > 0) {
-      for (global_counter = 0; global_counter < o_spin_cnt; global_counter++) {
+    if (is_recovered) {
+      if (stats->num_recovered_msgs == 0) {
+        stats->first_recovered_ts = cur_ts;
       }
+      stats->last_recovered_ts = cur_ts;
+      stats->num_recovered_msgs++;
+    }
+ 
+    if (num_workers > 0) {
+      worker_enqueue(&workers[src_state->worker_index], msg, perf_msg->msg_num);
+    }
+    else if (conflate != NULL) {
+      conflate_update(msg,
+          ((perf_msg->flags & FLAGS_KEY) == FLAGS_KEY) ? perf_msg->key : perf_msg->msg_num,
+          perf_msg->msg_num);
+    }
+    else if (workload_type != WORKLOAD_NONE) {
+      workload_run(&rcv_workload, msg->data, msg->len, perf_msg->msg_num);
+    }
+
+    if (rtt_mode != RTT_NONE) {
+      rtt_reply(msg);
+    }
+
+    /* With -O or -C, this acks delivery to the consumer thread. */
+    if (do_explicit_ack) {
+      explicit_ack(src_state, msg);
     }
     break;
   }
@@ -240,20 +2252,96 @@ int main(int argc, char **argv)
 #define MAX_RCVS 16
   lbm_rcv_t *rcvs[MAX_RCVS];
   int num_rcvs = 0;
+  CPRT_THREAD_T xport_stats_thread_id;
   CPRT_NET_START;
 
   get_my_opts(argc, argv);
 
-  printf("o_affinity_cpu=%d, o_config=%s, o_exit_on_eos=%d, o_persist='%s', o_spin_cnt=%d, o_topics='%s', o_xml_config=%s, \n",
-      o_affinity_cpu, o_config, o_exit_on_eos, o_persist, o_spin_cnt, o_topics, o_xml_config);
+  if (hist_num_buckets > 0) {
+    do_histogram = 1;
+    hist_create(&recovered_latency_hist, "recovered_latency_ns",
+        hist_num_buckets, hist_ns_per_bucket);
+    hist_create(&gap_size_hist, "gap_size_msgs", hist_num_buckets, 1);
+    hist_create(&gap_recovery_hist, "gap_recovery_ns",
+        hist_num_buckets, hist_ns_per_bucket);
+  }
+
+  printf("o_ack=%s, o_affinity_cpu=%d, o_config=%s, o_conflate=%s, o_exit_on_eos=%d, o_histogram=%s, o_offload=%s, o_persist='%s', o_transport='%s', o_evq_sample_ms=%d, o_rtt='%s', o_xport_stats_ms=%d, o_spin_cnt=%d, o_topics='%s', o_workload='%s', o_xml_config=%s, o_xsps=%s, o_zero_copy=%d, \n",
+      o_ack, o_affinity_cpu, o_config, o_conflate, o_exit_on_eos, o_histogram, o_offload, o_persist, o_transport, o_evq_sample_ms, o_rtt, o_xport_stats_ms, o_spin_cnt, o_topics, o_workload, o_xml_config, o_xsps, o_zero_copy);
+
+  if (workload_type != WORKLOAD_NONE) {
+    workload_init(&rcv_workload);
+    workload_calibrate(&rcv_workload);
+  }
+  if (num_workers > 0) {
+    workers_create();
+  }
+  if (conflate_num_keys > 0) {
+    conflate_create();
+  }
 
   /* Create UM context. */
-  E(lbm_context_create(&ctx, NULL, NULL, NULL));
+  lbm_context_attr_t *ctx_attr;
+  E(lbm_context_attr_create(&ctx_attr));
+  if (num_xsps > 0) {
+    lbm_transport_mapping_func_t mapping_func;
+
+    CPRT_MUTEX_INIT(shared_lock);
+    mapping_func.mapping_func = xsp_mapping_cb;
+    mapping_func.clientd = NULL;
+    E(lbm_context_attr_setopt(ctx_attr, "transport_mapping_function",
+        &mapping_func, sizeof(mapping_func)));
+  }
+  if (strcmp(o_transport, "lbtipc") == 0) {
+    /* The LBT-IPC receive thread waits on a semaphore by default; poll the
+     * shared memory instead, like LBT-SMX does. */
+    E(lbm_context_attr_str_setopt(ctx_attr,
+        "transport_lbtipc_receiver_thread_behavior", "busy_wait"));
+  }
+  E(lbm_context_create(&ctx, ctx_attr, NULL, NULL));
+  E(lbm_context_attr_delete(ctx_attr));
+
+  if (num_xsps > 0) {
+    /* Must exist before the receivers join any transports. */
+    xsps_create(ctx);
+  }
+
+  if (o_evq_sample_ms > 0) {
+    evq_create();
+  }
+  if (rtt_mode == RTT_PONG) {
+    lbm_topic_t *pong_topic_obj;
+    E(lbm_src_topic_alloc(&pong_topic_obj, ctx, rtt_pong_topic, NULL));
+    E(lbm_src_create(&rtt_pong_src, ctx, pong_topic_obj, NULL, NULL, NULL));
+  }
+  if (o_xport_stats_ms > 0) {
+    CPRT_THREAD_CREATE(xport_stats_thread_id, xport_stats_thread, ctx);
+  }
+  if (ack_interval_us > 0) {
+    CPRT_THREAD_T ack_thread_id;
+    CPRT_MUTEX_INIT(ack_srcs_lock);
+    CPRT_THREAD_CREATE(ack_thread_id, ack_timer_thread, NULL);
+  }
 
   /* Set some options in code. */
   E(lbm_rcv_topic_attr_create(&rcv_attr));
 
   E(lbm_rcv_topic_attr_str_setopt(rcv_attr, "ume_session_id", "0x7"));
+  if (do_explicit_ack) {
+    E(lbm_rcv_topic_attr_str_setopt(rcv_attr, "ume_explicit_ack_only", "1"));
+  }
+  if (do_histogram) {
+    /* Ordered delivery hides gaps (see rcv_callback()), which would leave
+     * the gap histograms empty. */
+    E(lbm_rcv_topic_attr_str_setopt(rcv_attr, "ordered_delivery", "0"));
+    printf("ordered_delivery=0, (set by -H for the gap histograms), \n");
+    fflush(stdout);
+  }
+
+  /* Get per-source state for each receiver. */
+  lbm_rcv_src_notification_func_t src_notif_conf;
+  src_notif_conf.create_func = src_create_cb;
+  src_notif_conf.delete_func = src_delete_cb;
 
   /* Parse out the individual topics in o_topics and create receiver objects. */
   char *strtok_context;
@@ -262,17 +2350,28 @@ int main(int argc, char **argv)
   while (cur_topic != NULL) {
     ASSRT(strlen(cur_topic) > 0);
     ASSRT(num_rcvs < MAX_RCVS);
+    /* The attribute is copied by the lookup, so clientd can be per topic. */
+    src_notif_conf.clientd = cur_topic;
+    E(lbm_rcv_topic_attr_setopt(rcv_attr, "source_notification_function",
+        &src_notif_conf, sizeof(src_notif_conf)));
     E(lbm_rcv_topic_lookup(&topic_obj, ctx, cur_topic, rcv_attr));
-    E(lbm_rcv_create(&rcvs[num_rcvs], ctx, topic_obj, rcv_callback, NULL, NULL));
+    E(lbm_rcv_create(&rcvs[num_rcvs], ctx, topic_obj, rcv_callback, NULL, evq));
 
     num_rcvs++;
     cur_topic = CPRT_STRTOK(NULL, ",", &strtok_context);
   }
 
-  /* The subscriber must be "kill"ed externally. */
-  sleep(2000000000);  /* 23+ centuries. */
+  /* Without -E, the subscriber must be "kill"ed externally. */
+  while (! exit_requested) {
+    usleep(100000);
+  }
+
+  if (o_xport_stats_ms > 0) {
+    stats_exit = 1;
+    CPRT_THREAD_JOIN(xport_stats_thread_id);
+  }
 
-  /* Should delete receivers and context, but this tool never exits. */
+  /* Should delete receivers and context, but the process is exiting. */
 
   CPRT_NET_CLEANUP;
   return 0;
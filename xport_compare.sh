@@ -0,0 +1,45 @@
+#!/bin/sh
+# xport_compare.sh - compare UM transports on one host.
+#
+# For each transport in TRANSPORTS, runs um_perf_sub and um_perf_pub on this
+# host with "-P transport" (the publisher overrides um.xml's "transport lbtrm"),
+# and prints the publisher's send rate and the subscriber's EOS latency line.
+# The full output of each run is kept in xport_compare_<transport>_pub.log
+# and xport_compare_<transport>_sub.log.
+#
+# Environment variables (defaults in brackets):
+#   TRANSPORTS - transports to run, in order [lbtrm lbtru tcp lbtipc lbtsmx]
+#   RATE - publisher message rate [100000]
+#   NUM_MSGS - publisher message count [1000000]
+#   MSG_LEN - message length [700]
+#   PUB_CPU - publisher "-a" affinity CPU [1]
+#   SUB_CPU - subscriber "-a" affinity CPU [3]
+
+. ./lbm.sh
+
+TRANSPORTS=${TRANSPORTS:-"lbtrm lbtru tcp lbtipc lbtsmx"}
+RATE=${RATE:-100000}
+NUM_MSGS=${NUM_MSGS:-1000000}
+MSG_LEN=${MSG_LEN:-700}
+PUB_CPU=${PUB_CPU:-1}
+SUB_CPU=${SUB_CPU:-3}
+
+for T in $TRANSPORTS; do :
+  ./um_perf_sub -x um.xml -a $SUB_CPU -t topic1 -P $T -E \
+    >xport_compare_${T}_sub.log 2>&1 &
+  SUB_PID=$!
+  sleep 1
+
+  # LBT-SMX requires a generic source (-g); use it for all for a fair compare.
+  ./um_perf_pub -x um.xml -a $PUB_CPU -m $MSG_LEN -n $NUM_MSGS -r $RATE \
+    -t topic1 -g -P $T -T -w 5,5 >xport_compare_${T}_pub.log 2>&1
+  echo "$T: pub exit status $?"
+
+  wait $SUB_PID
+  echo "$T: sub exit status $?"
+
+  grep "^actual_sends=" xport_compare_${T}_pub.log
+  grep "^rcv event EOS, .*all sources" xport_compare_${T}_sub.log
+  grep "WARNING" xport_compare_${T}_sub.log
+  echo ""
+done
@@ -0,0 +1,50 @@
+#!/bin/sh
+# zerocopy_sweep.sh - find the message size where MSG_ZEROCOPY beats copying.
+#
+# For each message size in SIZES, runs sock_perf_pub twice, without and
+# with "-z" (MSG_ZEROCOPY), as fast as it can go, and prints the send rate
+# and CPU time per message of each. No subscriber is needed. The full
+# output of each run is kept in zerocopy_sweep_<size>_<copy|zc>.log.
+#
+# IFACE must be set to a real NIC's address; on loopback there is no device
+# DMA to save, and the kernel copies every "zerocopy" send anyway.
+#
+# Environment variables (defaults in brackets):
+#   IFACE - interface address (required)
+#   SIZES - message lengths to run [1024 2048 4096 8192 16384 32768 65000]
+#   NUM_MSGS - messages per run [100000]
+#   ENGINE - sock_perf_pub "-e" send engine [sendmsg]
+#   ZC_BUFS - zerocopy buffer pool size, a power of 2 [256]
+#   GROUP - multicast group [239.101.3.1]
+#   PUB_CPU - publisher "-a" affinity CPU [1]
+
+if [ -z "$IFACE" ]; then :
+  echo "Error, IFACE must be set to a NIC's interface address" >&2
+  exit 1
+fi
+SIZES=${SIZES:-"1024 2048 4096 8192 16384 32768 65000"}
+NUM_MSGS=${NUM_MSGS:-100000}
+ENGINE=${ENGINE:-sendmsg}
+ZC_BUFS=${ZC_BUFS:-256}
+GROUP=${GROUP:-239.101.3.1}
+PUB_CPU=${PUB_CPU:-1}
+
+# A rate far above what the kernel can do keeps the publisher saturated,
+# so cpu_ns_per_msg is the cost of a send rather than of busy-looping.
+for S in $SIZES; do :
+  for Z in 0 $ZC_BUFS; do :
+    if [ $Z -eq 0 ]; then MODE=copy; else MODE=zc; fi
+    ./sock_perf_pub -g $GROUP -i $IFACE -a $PUB_CPU -m $S -n $NUM_MSGS \
+      -r 100000000 -e $ENGINE -z $Z -w 1000,100000 \
+      >zerocopy_sweep_${S}_${MODE}.log 2>&1
+    echo "msg_len=$S, mode=$MODE, `grep '^actual_sends=' zerocopy_sweep_${S}_${MODE}.log | sed 's/.*\(result_rate=[^,]*\).*\(cpu_ns_per_msg=[^,]*\).*/\1, \2/'`, "
+    grep -e "^zerocopy_sends=" -e "WARNING" zerocopy_sweep_${S}_${MODE}.log
+    # If the kernel copied every send, the "zc" numbers measure copying.
+    if [ $Z -ne 0 ] && grep '^zerocopy_sends=' zerocopy_sweep_${S}_${MODE}.log | \
+        sed 's/.*zerocopy_completions=\([0-9]*\), zerocopy_copied=\([0-9]*\),.*/\1 \2/' | \
+        awk '{ all_copied = ($1 > 0 && $1 == $2) } END { exit !all_copied }'; then :
+      echo "WARNING: msg_len=$S, every zerocopy send was copied (loopback or unsupported NIC?), "
+    fi
+  done
+done
+exit 0